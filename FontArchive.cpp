@@ -0,0 +1,245 @@
+// ==========================================================================
+// Font Archive Support
+//
+// This module defines a FontArchive class that reads font files straight out
+// of a .zip archive. The archive is mapped into memory and its members are
+// found through the central directory. Stored members are used in place;
+// deflated members are inflated on first use and kept for the rest of the
+// process.
+// ==========================================================================
+
+#include "FontArchive.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// only the zlib decoder of stb_image is needed, kept private to this file
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_NO_STDIO
+#if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include <stb_image.h>
+#if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+// little-endian fields of zip records
+static unsigned int Read16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int Read32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static const unsigned int LOCAL_HEADER = 0x04034b50;
+static const unsigned int CENTRAL_HEADER = 0x02014b50;
+static const unsigned int END_OF_DIRECTORY = 0x06054b50;
+
+// --------------------------------------------------------------------------
+
+FontArchive::FontArchive()
+    : m_data(0), m_size(0)
+{
+}
+
+FontArchive::~FontArchive()
+{
+#ifndef _WIN32
+    if (m_data && m_copy.empty())
+        munmap((void *)m_data, m_size);
+#endif
+}
+
+FontArchive *FontArchive::Open(const string &path)
+{
+    // archives stay open until the process exits, since faces created from
+    // their members keep pointing into them
+    static mutex registryMutex;
+    static map<string, unique_ptr<FontArchive> > registry;
+
+    lock_guard<mutex> guard(registryMutex);
+    map<string, unique_ptr<FontArchive> >::iterator it = registry.find(path);
+    if (it != registry.end())
+        return it->second.get();
+
+    unique_ptr<FontArchive> archive(new FontArchive);
+    if (!archive->Map(path) || !archive->ReadDirectory()) {
+        cout << "Font archive ERROR: could not read " << path << endl;
+        archive.reset();
+    }
+    return (registry[path] = std::move(archive)).get();
+}
+
+bool FontArchive::SplitName(const string &name, string &archive, string &member)
+{
+    size_t split = name.find(".zip/");
+    if (split == string::npos) return false;
+
+    archive = name.substr(0, split + 4);
+    member = name.substr(split + 5);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool FontArchive::Map(const string &path)
+{
+    m_path = path;
+
+#ifndef _WIN32
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat status;
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        void *mapped = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped != MAP_FAILED) {
+            m_data = (const unsigned char *)mapped;
+            m_size = status.st_size;
+        }
+    }
+    close(file);
+    return m_data != 0;
+#else
+    // no mapping here, so read the whole archive instead
+    ifstream in(path.c_str(), ios::binary);
+    if (!in) return false;
+    m_copy.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    m_data = m_copy.empty() ? 0 : &m_copy[0];
+    m_size = m_copy.size();
+    return m_data != 0;
+#endif
+}
+
+bool FontArchive::ReadDirectory()
+{
+    // the end of central directory record is at the very end, possibly
+    // followed by a comment of up to 64K
+    if (m_size < 22) return false;
+    size_t end = m_size - 22;
+    size_t limit = m_size > 22 + 0xFFFF ? m_size - 22 - 0xFFFF : 0;
+    while (Read32(m_data + end) != END_OF_DIRECTORY) {
+        if (end == limit) return false;
+        --end;
+    }
+
+    unsigned int count = Read16(m_data + end + 10);
+    size_t offset = Read32(m_data + end + 16);
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (offset + 46 > m_size || Read32(m_data + offset) != CENTRAL_HEADER)
+            return false;
+
+        const unsigned char *header = m_data + offset;
+        unsigned int nameLength = Read16(header + 28);
+        if (offset + 46 + nameLength > m_size)
+            return false;
+
+        Member member;
+        member.flags = Read16(header + 8);
+        member.method = Read16(header + 10);
+        member.compressedSize = Read32(header + 20);
+        member.size = Read32(header + 24);
+        member.headerOffset = Read32(header + 42);
+        member.name.assign((const char *)header + 46, nameLength);
+
+        // directories have no data
+        if (!member.name.empty() && member.name[member.name.size() - 1] != '/')
+            m_members.push_back(member);
+
+        offset += 46 + nameLength + Read16(header + 30) + Read16(header + 32);
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+vector<string> FontArchive::MemberNames() const
+{
+    vector<string> names;
+    for (size_t i = 0; i < m_members.size(); ++i)
+        names.push_back(m_members[i].name);
+    return names;
+}
+
+bool FontArchive::MemberData(const string &name, const unsigned char *&data, size_t &size)
+{
+    const Member *member = 0;
+    for (size_t i = 0; i < m_members.size() && !member; ++i)
+        if (m_members[i].name == name) member = &m_members[i];
+    if (!member) {
+        cout << "Font archive ERROR: no " << name << " in " << m_path << endl;
+        return false;
+    }
+    if (member->flags & 0x1) {
+        cout << "Font archive ERROR: " << name << " is encrypted" << endl;
+        return false;
+    }
+    if (member->size == 0) {
+        cout << "Font archive ERROR: " << name << " is empty" << endl;
+        return false;
+    }
+
+    // the data follows the local header, whose name and extra field lengths
+    // may differ from those in the central directory
+    size_t offset = member->headerOffset;
+    if (offset + 30 > m_size || Read32(m_data + offset) != LOCAL_HEADER)
+        return false;
+    offset += 30 + Read16(m_data + offset + 26) + Read16(m_data + offset + 28);
+    if (offset + member->compressedSize > m_size)
+        return false;
+
+    // stored members are used where they lie
+    if (member->method == 0) {
+        data = m_data + offset;
+        size = member->size;
+        return true;
+    }
+    if (member->method != 8) {
+        cout << "Font archive ERROR: unsupported compression for " << name << endl;
+        return false;
+    }
+
+    // deflated members are inflated once
+    lock_guard<mutex> guard(m_mutex);
+    map<string, vector<unsigned char> >::iterator it = m_inflated.find(name);
+    if (it == m_inflated.end())
+    {
+        vector<unsigned char> inflated(member->size);
+        int length = stbi_zlib_decode_noheader_buffer((char *)&inflated[0], int(inflated.size()),
+            (const char *)m_data + offset, int(member->compressedSize));
+        if (length != int(member->size)) {
+            cout << "Font archive ERROR: could not inflate " << name << endl;
+            return false;
+        }
+        it = m_inflated.insert(make_pair(name, vector<unsigned char>())).first;
+        it->second.swap(inflated);
+    }
+
+    data = &it->second[0];
+    size = it->second.size();
+    return true;
+}
+
+// --------------------------------------------------------------------------
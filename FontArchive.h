@@ -0,0 +1,76 @@
+// ==========================================================================
+// Font Archive Support
+//
+// This module defines a FontArchive class that reads font files straight out
+// of a .zip archive. The archive is mapped into memory and its members are
+// found through the central directory. Stored members are used in place;
+// deflated members are inflated on first use and kept for the rest of the
+// process, so each member is inflated at most once however many extractors
+// (or threads) open it.
+//
+// Fonts inside an archive are named by the archive path followed by the
+// member name, e.g. "fonts/lora.zip/Lora-Regular.ttf". Zip64 archives and
+// encrypted members are not supported.
+// ==========================================================================
+#ifndef FONTARCHIVE_H
+#define FONTARCHIVE_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class FontArchive
+{
+    // a member as listed in the central directory
+    struct Member
+    {
+        std::string   name;
+        unsigned int  flags;
+        unsigned int  method;
+        std::size_t   compressedSize;
+        std::size_t   size;
+        std::size_t   headerOffset;
+    };
+
+    // the mapped archive
+    std::string          m_path;
+    const unsigned char *m_data;
+    std::size_t          m_size;
+    std::vector<unsigned char> m_copy;
+
+    std::vector<Member> m_members;
+
+    // inflated members, by name, guarded by m_mutex
+    std::map<std::string, std::vector<unsigned char> > m_inflated;
+    std::mutex m_mutex;
+
+    bool Map(const std::string &path);
+    bool ReadDirectory();
+
+    FontArchive();
+    FontArchive(const FontArchive &);
+    FontArchive &operator=(const FontArchive &);
+
+public:
+    ~FontArchive();
+
+    // returns the process-wide archive for a path, opening it on first use,
+    // or 0 if it cannot be read
+    static FontArchive *Open(const std::string &path);
+
+    // splits "archive.zip/member" into its two parts; false if the name
+    // does not refer into a zip archive
+    static bool SplitName(const std::string &name, std::string &archive, std::string &member);
+
+    // names of all members
+    std::vector<std::string> MemberNames() const;
+
+    // the bytes of a member, valid for the rest of the process; false if the
+    // member is missing or cannot be extracted
+    bool MemberData(const std::string &name, const unsigned char *&data, std::size_t &size);
+};
+
+// --------------------------------------------------------------------------
+#endif // FONTARCHIVE_H
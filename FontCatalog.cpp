@@ -0,0 +1,319 @@
+// ==========================================================================
+// Font Catalog
+//
+// This module defines a FontCatalog class that resolves fonts by family and
+// style instead of by file name. A font directory is scanned once, reading
+// each face's family, style, weight and Unicode coverage from its name and
+// OS/2 tables, and the result is kept in an index file beside the fonts. On
+// later runs the index is revalidated by comparing each file's modification
+// time and size, so only new or changed files are opened again.
+// ==========================================================================
+
+#include "FontCatalog.h"
+#include "FontArchive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <dirent.h>
+#endif
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+using namespace std;
+
+// first line of an index file, bumped whenever the format changes
+static const char *INDEX_HEADER = "FONTCATALOG 1";
+
+// --------------------------------------------------------------------------
+
+static bool IsFontFile(const string &name)
+{
+    string extension = name.substr(name.find_last_of('.') + 1);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "ttf" || extension == "otf" || extension == "ttc";
+}
+
+// names of the font files directly inside a directory, and of the zip
+// archives that contain any
+static vector<string> ListFontFiles(const string &directory)
+{
+    vector<string> names;
+
+#ifdef _WIN32
+    _finddata_t data;
+    intptr_t handle = _findfirst((directory + "/*").c_str(), &data);
+    if (handle != -1) {
+        do names.push_back(data.name); while (_findnext(handle, &data) == 0);
+        _findclose(handle);
+    }
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir) {
+        while (dirent *entry = readdir(dir))
+            names.push_back(entry->d_name);
+        closedir(dir);
+    }
+#endif
+
+    vector<string> fonts;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        string extension = names[i].substr(names[i].find_last_of('.') + 1);
+        transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (IsFontFile(names[i]) || extension == "zip")
+            fonts.push_back(names[i]);
+    }
+    sort(fonts.begin(), fonts.end());
+    return fonts;
+}
+
+static bool SameText(const string &a, const string &b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+// reads the catalog fields of a font file, returning false if it cannot be opened
+static bool ScanFont(FT_Library library, MyFontEntry &entry)
+{
+    FT_Face face;
+    string archivePath, member;
+    if (FontArchive::SplitName(entry.path, archivePath, member))
+    {
+        FontArchive *archive = FontArchive::Open(archivePath);
+        const unsigned char *data;
+        size_t size;
+        if (!archive || !archive->MemberData(member, data, size)
+            || FT_New_Memory_Face(library, data, FT_Long(size), 0, &face))
+            return false;
+    }
+    else if (FT_New_Face(library, entry.path.c_str(), 0, &face))
+        return false;
+
+    entry.family = face->family_name ? face->family_name : "";
+    entry.style = face->style_name ? face->style_name : "";
+    entry.italic = (face->style_flags & FT_STYLE_FLAG_ITALIC) != 0;
+    entry.weight = (face->style_flags & FT_STYLE_FLAG_BOLD) ? 700 : 400;
+    entry.glyphCount = face->num_glyphs;
+
+    TT_OS2 *os2 = (TT_OS2 *)FT_Get_Sfnt_Table(face, ft_sfnt_os2);
+    if (os2 && os2->version != 0xFFFF) {
+        entry.weight = os2->usWeightClass;
+        entry.unicodeRanges[0] = os2->ulUnicodeRange1;
+        entry.unicodeRanges[1] = os2->ulUnicodeRange2;
+        entry.unicodeRanges[2] = os2->ulUnicodeRange3;
+        entry.unicodeRanges[3] = os2->ulUnicodeRange4;
+    }
+
+    // TrueType outlines live in the glyf table, CFF outlines do not
+    FT_ULong length = 0;
+    entry.degree = (FT_Load_Sfnt_Table(face, TTAG_glyf, 0, 0, &length) == 0) ? 2 : 3;
+
+    FT_Done_Face(face);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool FontCatalog::ReadIndex()
+{
+    ifstream in(m_indexFile.c_str());
+    string line;
+    if (!getline(in, line) || line != INDEX_HEADER)
+        return false;
+
+    while (getline(in, line))
+    {
+        vector<string> fields;
+        stringstream stream(line);
+        string field;
+        while (getline(stream, field, '\t'))
+            fields.push_back(field);
+        if (fields.size() != 13) continue;
+
+        MyFontEntry entry;
+        entry.path = fields[0];
+        entry.mtime = atoll(fields[1].c_str());
+        entry.size = atoll(fields[2].c_str());
+        entry.family = fields[3];
+        entry.style = fields[4];
+        entry.weight = atoi(fields[5].c_str());
+        entry.italic = atoi(fields[6].c_str()) != 0;
+        entry.degree = atoi(fields[7].c_str());
+        entry.glyphCount = atoi(fields[8].c_str());
+        for (int i = 0; i < 4; ++i)
+            entry.unicodeRanges[i] = strtoul(fields[9 + i].c_str(), 0, 16);
+        m_entries.push_back(entry);
+    }
+    return true;
+}
+
+bool FontCatalog::WriteIndex() const
+{
+    ofstream out(m_indexFile.c_str());
+    if (!out) {
+        cout << "Font catalog ERROR: could not write " << m_indexFile << endl;
+        return false;
+    }
+
+    out << INDEX_HEADER << endl;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const MyFontEntry &entry = m_entries[i];
+        out << entry.path << '\t' << entry.mtime << '\t' << entry.size << '\t'
+            << entry.family << '\t' << entry.style << '\t' << entry.weight << '\t'
+            << (entry.italic ? 1 : 0) << '\t' << entry.degree << '\t' << entry.glyphCount
+            << hex;
+        for (int r = 0; r < 4; ++r)
+            out << '\t' << entry.unicodeRanges[r];
+        out << dec << endl;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool FontCatalog::Open(const string &directory, const string &indexFile)
+{
+    m_directory = directory;
+    m_indexFile = indexFile;
+    m_entries.clear();
+
+    // what the index says, keyed by path
+    bool changed = !ReadIndex();
+    map<string, MyFontEntry> indexed;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+        indexed[m_entries[i].path] = m_entries[i];
+    m_entries.clear();
+
+    FT_Library library = 0;
+    int scanned = 0;
+
+    // fonts inside archives are listed as members, each validated by the
+    // time and size of the archive itself
+    vector<string> files = ListFontFiles(directory);
+    vector<MyFontEntry> candidates;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        MyFontEntry entry;
+        entry.path = directory + "/" + files[i];
+
+        struct stat status;
+        if (stat(entry.path.c_str(), &status) != 0) continue;
+        entry.mtime = status.st_mtime;
+        entry.size = status.st_size;
+
+        if (!IsFontFile(files[i]))
+        {
+            // only open an archive to list it if it has changed
+            string prefix = entry.path + "/";
+            vector<string> members;
+            bool current = false;
+            map<string, MyFontEntry>::iterator it = indexed.lower_bound(prefix);
+            for (; it != indexed.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+                current = it->second.mtime == entry.mtime && it->second.size == entry.size;
+                if (!current) break;
+                members.push_back(it->first.substr(prefix.size()));
+            }
+            if (!current) {
+                members.clear();
+                if (FontArchive *archive = FontArchive::Open(entry.path))
+                    members = archive->MemberNames();
+            }
+
+            string archivePath = entry.path;
+            for (size_t m = 0; m < members.size(); ++m) {
+                if (!IsFontFile(members[m])) continue;
+                entry.path = archivePath + "/" + members[m];
+                candidates.push_back(entry);
+            }
+        }
+        else
+            candidates.push_back(entry);
+    }
+
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        MyFontEntry entry = candidates[i];
+
+        // keep the indexed entry if the file has not changed since
+        map<string, MyFontEntry>::iterator it = indexed.find(entry.path);
+        if (it != indexed.end() && it->second.mtime == entry.mtime && it->second.size == entry.size) {
+            m_entries.push_back(it->second);
+            indexed.erase(it);
+            continue;
+        }
+
+        changed = true;
+        if (!library && FT_Init_FreeType(&library)) {
+            cout << "ERROR: FreeType failed to initialize!" << endl;
+            return false;
+        }
+        if (ScanFont(library, entry)) {
+            m_entries.push_back(entry);
+            scanned++;
+        }
+        else
+            cout << "Font catalog: skipping unreadable font " << entry.path << endl;
+    }
+    if (library) FT_Done_FreeType(library);
+
+    // anything left in the index no longer exists
+    if (!indexed.empty()) changed = true;
+
+    cout << "Font catalog: " << m_entries.size() << " fonts in " << directory
+         << ", " << scanned << " scanned" << endl;
+
+    return changed ? WriteIndex() : true;
+}
+
+// --------------------------------------------------------------------------
+
+const MyFontEntry *FontCatalog::Find(const string &family, const string &style) const
+{
+    // TrueType outlines first, then loose files over copies in an archive,
+    // which need not be inflated before they can be opened
+    string archivePath, member;
+    const MyFontEntry *found = 0;
+    bool foundArchived = false;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const MyFontEntry &entry = m_entries[i];
+        if (!SameText(entry.family, family) || !SameText(entry.style, style)) continue;
+        bool archived = FontArchive::SplitName(entry.path, archivePath, member);
+        if (!found || entry.degree < found->degree
+            || (entry.degree == found->degree && foundArchived && !archived))
+        {
+            found = &entry;
+            foundArchived = archived;
+        }
+    }
+    return found;
+}
+
+string FontCatalog::Resolve(const string &family, const string &style) const
+{
+    const MyFontEntry *entry = Find(family, style);
+    if (!entry) {
+        cout << "Font catalog: no font for " << family << " " << style << endl;
+        return "";
+    }
+    return entry->path;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,76 @@
+// ==========================================================================
+// Font Catalog
+//
+// This module defines a FontCatalog class that resolves fonts by family and
+// style instead of by file name. A font directory is scanned once, reading
+// each face's family, style, weight and Unicode coverage from its name and
+// OS/2 tables, and the result is kept in an index file beside the fonts. On
+// later runs the index is revalidated by comparing each file's modification
+// time and size, so only new or changed files are opened again.
+// ==========================================================================
+#ifndef FONTCATALOG_H
+#define FONTCATALOG_H
+
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------
+// DATA STRUCTURES: catalog entries
+
+struct MyFontEntry
+{
+    // file, and the modification time and size it had when it was read
+    std::string path;
+    long long   mtime;
+    long long   size;
+
+    // names from the font's name table, e.g. "Source Sans Pro", "Bold Italic"
+    std::string family;
+    std::string style;
+
+    // OS/2 weight class (400 regular, 700 bold) and italic flag
+    int  weight;
+    bool italic;
+
+    // degree of the outlines: 2 for TrueType, 3 for CFF
+    int degree;
+
+    // number of glyphs, and the OS/2 Unicode range bits (ulUnicodeRange1-4)
+    int           glyphCount;
+    unsigned long unicodeRanges[4];
+
+    MyFontEntry() : mtime(0), size(0), weight(400), italic(false), degree(2), glyphCount(0)
+    {
+        for (int i = 0; i < 4; ++i) unicodeRanges[i] = 0;
+    }
+};
+
+// --------------------------------------------------------------------------
+
+class FontCatalog
+{
+    std::string              m_directory;
+    std::string              m_indexFile;
+    std::vector<MyFontEntry> m_entries;
+
+    bool ReadIndex();
+    bool WriteIndex() const;
+
+public:
+    // loads the index for a font directory, rescanning only the files that
+    // were added or changed since it was written, and rewriting it if needed
+    bool Open(const std::string &directory, const std::string &indexFile);
+
+    // finds a font by family and style (case-insensitive), preferring
+    // TrueType outlines when a face comes in both flavours, and a loose file
+    // over a copy inside an archive; 0 if none
+    const MyFontEntry *Find(const std::string &family, const std::string &style) const;
+
+    // path of the font with the given family and style, or "" if none
+    std::string Resolve(const std::string &family, const std::string &style) const;
+
+    const std::vector<MyFontEntry> &Entries() const { return m_entries; }
+};
+
+// --------------------------------------------------------------------------
+#endif // FONTCATALOG_H
@@ -0,0 +1,80 @@
+// ==========================================================================
+// Font Fallback
+//
+// This module defines a FontFallback class that decides which font draws each
+// character of a run, falling back along an ordered chain of fonts when the
+// run's own font has no glyph for it.
+// ==========================================================================
+
+#include "FontFallback.h"
+#include <iostream>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+FontFallback::FontFallback()
+    : m_probes(0), m_hits(0)
+{
+}
+
+void FontFallback::SetChain(const vector<string> &fonts)
+{
+    m_chain = fonts;
+    m_resolved.clear();
+}
+
+// --------------------------------------------------------------------------
+
+GlyphExtractor *FontFallback::Face(const string &font)
+{
+    map<string, unique_ptr<GlyphExtractor> >::iterator it = m_faces.find(font);
+    if (it == m_faces.end())
+    {
+        // remember fonts that fail to open too, so they are only tried once
+        unique_ptr<GlyphExtractor> face(new GlyphExtractor);
+        if (!face->LoadFontFile(font)) {
+            cout << "Font fallback ERROR: could not open " << font << endl;
+            face.reset();
+        }
+        it = m_faces.insert(make_pair(font, std::move(face))).first;
+    }
+    return it->second.get();
+}
+
+const MyFallbackGlyph &FontFallback::Resolve(const string &font, int character)
+{
+    unordered_map<int, MyFallbackGlyph> &resolved = m_resolved[font];
+    unordered_map<int, MyFallbackGlyph>::iterator it = resolved.find(character);
+    if (it != resolved.end()) {
+        m_hits++;
+        return it->second;
+    }
+
+    // try the run's own font, then the chain in order
+    MyFallbackGlyph &glyph = resolved[character];
+    glyph.font = font;
+    for (size_t f = 0; f <= m_chain.size(); ++f)
+    {
+        const string &candidate = f ? m_chain[f-1] : font;
+        GlyphExtractor *face = Face(candidate);
+        if (!face) continue;
+
+        m_probes++;
+        unsigned int index = face->GlyphIndex(character);
+        if (index) {
+            glyph.font = candidate;
+            glyph.index = index;
+            glyph.advance = face->Advance(character);
+            return glyph;
+        }
+    }
+
+    // the missing glyph is as wide as the font makes it
+    GlyphExtractor *face = Face(font);
+    if (face)
+        glyph.advance = face->Advance(character);
+    return glyph;
+}
+
+// --------------------------------------------------------------------------
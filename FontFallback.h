@@ -0,0 +1,79 @@
+// ==========================================================================
+// Font Fallback
+//
+// This module defines a FontFallback class that decides which font draws each
+// character of a run: the run's own font if it has a glyph for it, or else the
+// first font of an ordered fallback chain that does. Each font's charmap is
+// read once, when the font is first needed, and every resolution is memoized
+// per font and character, so mixed-script text is resolved without probing
+// the chain again for characters already seen. Opening a font reads its
+// tables, so a FontFallback belongs on the loader thread rather than the
+// render thread.
+// ==========================================================================
+#ifndef FONTFALLBACK_H
+#define FONTFALLBACK_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GlyphExtractor.h"
+
+// --------------------------------------------------------------------------
+// DATA STRUCTURES: resolved glyphs
+
+// the font that draws a character, the glyph index of the character in it,
+// and its advance width in EM units
+struct MyFallbackGlyph
+{
+    std::string  font;
+    unsigned int index;
+    float        advance;
+
+    MyFallbackGlyph() : index(0), advance(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+
+class FontFallback
+{
+    // fonts to try, in order, after a run's own font
+    std::vector<std::string> m_chain;
+
+    // fonts opened so far, for their charmaps
+    std::map<std::string, std::unique_ptr<GlyphExtractor> > m_faces;
+
+    // resolutions so far, by run font and character
+    std::map<std::string, std::unordered_map<int, MyFallbackGlyph> > m_resolved;
+
+    // charmap lookups made, and resolutions answered from the memo
+    unsigned int m_probes;
+    unsigned int m_hits;
+
+    FontFallback(const FontFallback &);
+    FontFallback &operator=(const FontFallback &);
+
+public:
+    FontFallback();
+
+    // sets the fonts to fall back on, in order, forgetting earlier resolutions
+    void SetChain(const std::vector<std::string> &fonts);
+
+    // the font and glyph index to draw a character of text set in the given
+    // font with; if no font has the character, the given font's missing glyph
+    // (index 0) is drawn
+    const MyFallbackGlyph &Resolve(const std::string &font, int character);
+
+    // the extractor a font is probed with, opened on first use; null if it
+    // cannot be opened
+    GlyphExtractor *Face(const std::string &font);
+
+    unsigned int Probes() const { return m_probes; }
+    unsigned int Hits() const { return m_hits; }
+};
+
+// --------------------------------------------------------------------------
+#endif // FONTFALLBACK_H
@@ -17,8 +17,15 @@
 // ==========================================================================
 
 #include "GlyphExtractor.h"
+#include "FontArchive.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
+#include FT_ADVANCES_H
+#include FT_MULTIPLE_MASTERS_H
+
 // set this true to print information about the font loaded and glyphs extracted
 #define DEBUG_PRINT 0
 
@@ -26,8 +33,158 @@ using namespace std;
 
 // --------------------------------------------------------------------------
 
+// replaces curves whose control points all lie within tolerance of the chord
+// by straight lines
+static void FlattenCurves(MyGlyph &glyph, float tolerance)
+{
+    for (size_t c = 0; c < glyph.contours.size(); ++c)
+    {
+        for (size_t s = 0; s < glyph.contours[c].size(); ++s)
+        {
+            MySegment &segment = glyph.contours[c][s];
+            int d = segment.degree;
+            float dx = segment.x[d] - segment.x[0];
+            float dy = segment.y[d] - segment.y[0];
+            float length = sqrt(dx*dx + dy*dy);
+            if (d < 2 || length == 0)
+                continue;
+
+            float deviation = 0;
+            for (int i = 1; i < d; ++i) {
+                float cross = (segment.x[i] - segment.x[0]) * dy - (segment.y[i] - segment.y[0]) * dx;
+                deviation = max(deviation, fabs(cross) / length);
+            }
+            if (deviation < tolerance) {
+                segment.x[1] = segment.x[d];
+                segment.y[1] = segment.y[d];
+                segment.degree = 1;
+            }
+        }
+    }
+}
+
+// true if every control point of a segment is at its start
+static bool Degenerate(const MySegment &segment)
+{
+    for (unsigned int i = 1; i <= segment.degree; ++i)
+        if (segment.x[i] != segment.x[0] || segment.y[i] != segment.y[0])
+            return false;
+    return true;
+}
+
+// true if each of the points lies within tolerance of the line from (x0, y0)
+// to (x1, y1), and between its ends
+static bool OnLine(float x0, float y0, float x1, float y1,
+                   const vector<float> &points, float tolerance)
+{
+    float dx = x1 - x0, dy = y1 - y0;
+    float length = sqrt(dx*dx + dy*dy);
+    if (length == 0)
+        return false;
+    for (size_t i = 0; i < points.size(); i += 2)
+    {
+        float px = points[i] - x0, py = points[i+1] - y0;
+        float along = (px * dx + py * dy) / length;
+        if (fabs(px * dy - py * dx) / length >= tolerance || along <= 0 || along >= length)
+            return false;
+    }
+    return true;
+}
+
+int CleanGlyph(MyGlyph &glyph, float tolerance)
+{
+    int before = 0, after = 0;
+    float area = 0;
+    vector<MyContour> contours;
+    for (size_t c = 0; c < glyph.contours.size(); ++c)
+    {
+        const MyContour &original = glyph.contours[c];
+        before += original.size();
+
+        // drop segments that have collapsed to a point, and extend a line
+        // rather than starting another while the points it passes through
+        // stay on it
+        MyContour contour;
+        vector<float> joints, firstJoints;
+        for (size_t s = 0; s < original.size(); ++s)
+        {
+            const MySegment &segment = original[s];
+            if (Degenerate(segment))
+                continue;
+
+            if (segment.degree == 1 && !contour.empty() && contour.back().degree == 1)
+            {
+                MySegment &line = contour.back();
+                vector<float> through(joints);
+                through.push_back(line.x[1]);
+                through.push_back(line.y[1]);
+                if (OnLine(line.x[0], line.y[0], segment.x[1], segment.y[1], through, tolerance)) {
+                    line.x[1] = segment.x[1];
+                    line.y[1] = segment.y[1];
+                    joints.swap(through);
+                    if (contour.size() == 1)
+                        firstJoints = joints;
+                    continue;
+                }
+            }
+            contour.push_back(segment);
+            joints.clear();
+        }
+
+        // the last line may also carry on into the first, as long as the
+        // points already folded into either of them stay on the joined line
+        if (contour.size() > 1 && contour.front().degree == 1 && contour.back().degree == 1)
+        {
+            MySegment &first = contour.front();
+            const MySegment &last = contour.back();
+            vector<float> through(joints);
+            through.push_back(last.x[1]);
+            through.push_back(last.y[1]);
+            through.insert(through.end(), firstJoints.begin(), firstJoints.end());
+            if (OnLine(last.x[0], last.y[0], first.x[1], first.y[1], through, tolerance)) {
+                first.x[0] = last.x[0];
+                first.y[0] = last.y[0];
+                contour.pop_back();
+            }
+        }
+        if (contour.empty())
+            continue;
+
+        // signed area of the control polygon, positive if anticlockwise
+        for (size_t s = 0; s < contour.size(); ++s) {
+            const MySegment &segment = contour[s];
+            for (unsigned int i = 0; i < segment.degree; ++i)
+                area += segment.x[i] * segment.y[i+1] - segment.x[i+1] * segment.y[i];
+        }
+
+        after += contour.size();
+        contours.push_back(contour);
+    }
+
+    // outer contours run clockwise in TrueType fonts but anticlockwise in
+    // CFF ones; turn the latter round so that every glyph follows TrueType
+    if (area > 0)
+    {
+        for (size_t c = 0; c < contours.size(); ++c)
+        {
+            MyContour &contour = contours[c];
+            reverse(contour.begin(), contour.end());
+            for (size_t s = 0; s < contour.size(); ++s) {
+                MySegment &segment = contour[s];
+                reverse(segment.x, segment.x + segment.degree + 1);
+                reverse(segment.y, segment.y + segment.degree + 1);
+            }
+        }
+    }
+
+    glyph.contours.swap(contours);
+    return before - after;
+}
+
+// --------------------------------------------------------------------------
+
 GlyphExtractor::GlyphExtractor()
-    : m_face(0)
+    : m_face(0), m_kerningRead(false), m_ppem(0)
 {
     // initialize freetype library
     FT_Error error = FT_Init_FreeType(&m_library);
@@ -36,11 +193,46 @@ GlyphExtractor::GlyphExtractor()
     }
 }
 
+GlyphExtractor::~GlyphExtractor()
+{
+    if (m_face) FT_Done_Face(m_face);
+    FT_Done_FreeType(m_library);
+}
+
 // --------------------------------------------------------------------------
 
 bool GlyphExtractor::LoadFontFile(const string &filename)
 {
-    FT_Error error = FT_New_Face(m_library, filename.c_str(), 0, &m_face);
+    // release the previously loaded face, if any, along with everything read
+    // from it, so that nothing answers for it should the new one fail to open
+    if (m_face) {
+        FT_Done_Face(m_face);
+        m_face = 0;
+    }
+    m_advances.clear();
+    m_bmpIndices.clear();
+    m_supplementaryIndices.clear();
+    m_axisMinimum.clear();
+    m_axisDefault.clear();
+    m_axisMaximum.clear();
+    m_ppem = 0;
+    m_kerning.Clear();
+    m_kerningRead = false;
+
+    // fonts inside a zip archive are opened from memory
+    FT_Error error;
+    string archivePath, member;
+    if (FontArchive::SplitName(filename, archivePath, member))
+    {
+        FontArchive *archive = FontArchive::Open(archivePath);
+        const unsigned char *data;
+        size_t size;
+        if (!archive || !archive->MemberData(member, data, size))
+            return false;
+        error = FT_New_Memory_Face(m_library, data, FT_Long(size), 0, &m_face);
+    }
+    else
+        error = FT_New_Face(m_library, filename.c_str(), 0, &m_face);
 
     if (error == FT_Err_Unknown_File_Format) {
         cout << "Freetype ERROR: unsupported file format in " << filename << endl;
@@ -53,6 +245,42 @@ bool GlyphExtractor::LoadFontFile(const string &filename)
 
     if (DEBUG_PRINT) PrintFontInformation();
 
+    // note the range of each variation axis, for fonts that have them
+    FT_MM_Var *master;
+    if (FT_HAS_MULTIPLE_MASTERS(m_face) && !FT_Get_MM_Var(m_face, &master)) {
+        for (FT_UInt a = 0; a < master->num_axis; ++a) {
+            m_axisMinimum.push_back(master->axis[a].minimum);
+            m_axisDefault.push_back(master->axis[a].def);
+            m_axisMaximum.push_back(master->axis[a].maximum);
+        }
+        free(master);
+    }
+
+    // walk the charmap once, so that characters never have to be looked up
+    // in it again
+    m_bmpIndices.assign(0x10000, 0);
+    FT_UInt index;
+    for (FT_ULong c = FT_Get_First_Char(m_face, &index); index != 0; c = FT_Get_Next_Char(m_face, c, &index)) {
+        if (c < 0x10000)
+            m_bmpIndices[c] = index;
+        else
+            m_supplementaryIndices[c] = index;
+    }
+
+    // read the advance widths of the whole font in one go; unscaled advances
+    // come back in font units
+    FT_Long count = m_face->num_glyphs;
+    std::vector<FT_Fixed> advances(count);
+    m_advances.assign(count, 0.0f);
+    if (count > 0 && FT_Get_Advances(m_face, 0, count, FT_LOAD_NO_SCALE, &advances[0])) {
+        cout << "FreeType ERROR: could not read advance widths from " << filename << endl;
+    }
+    else {
+        float em = m_face->units_per_EM;
+        for (FT_Long i = 0; i < count; ++i)
+            m_advances[i] = advances[i] / em;
+    }
+
     return true;
 }
 
@@ -66,12 +294,11 @@ void GlyphExtractor::PrintFontInformation() const
     cout << "  Units per EM: \t" << m_face->units_per_EM << endl;
 }
 
-void GlyphExtractor::PrintGlyphInformation(int character) const
+void GlyphExtractor::PrintGlyphInformation(unsigned int index) const
 {
     FT_Outline &outline = m_face->glyph->outline;
 
-    cout << "Glyph information for character "
-         << character << " (" << char(character) << "):" <<  endl;
+    cout << "Glyph information for glyph index " << index << ":" <<  endl;
     cout << "  Advance: " << m_face->glyph->advance.x
          << ", " << m_face->glyph->advance.y << endl;
     cout << "  Number of contours: " << outline.n_contours << endl;
@@ -90,7 +317,41 @@ void GlyphExtractor::PrintGlyphInformation(int character) const
 
 // --------------------------------------------------------------------------
 
+unsigned int GlyphExtractor::GlyphIndex(int character) const
+{
+    if (character < 0) return 0;
+    if (character < int(m_bmpIndices.size()))
+        return m_bmpIndices[character];
+
+    map<int, unsigned int>::const_iterator it = m_supplementaryIndices.find(character);
+    return it != m_supplementaryIndices.end() ? it->second : 0;
+}
+
+float GlyphExtractor::Advance(int character) const
+{
+    unsigned int index = GlyphIndex(character);
+    return index < m_advances.size() ? m_advances[index] : 0.0f;
+}
+
+const KerningTable &GlyphExtractor::KerningPairs()
+{
+    // flatten the pairs once, so that layout never goes back to the tables
+    if (!m_kerningRead && m_face) {
+        m_kerning.Read(m_face);
+        m_kerningRead = true;
+    }
+    return m_kerning;
+}
+
+// --------------------------------------------------------------------------
+
 MyGlyph GlyphExtractor::ExtractGlyph(int character) const
+{
+    // look up the glyph index for the given character code
+    return ExtractGlyphByIndex(GlyphIndex(character));
+}
+
+MyGlyph GlyphExtractor::ExtractGlyphByIndex(unsigned int index) const
 {
     // first check that a font has been loaded
     if (!m_face) {
@@ -98,24 +359,136 @@ MyGlyph GlyphExtractor::ExtractGlyph(int character) const
         return MyGlyph();
     }
 
-    // look up the glyph index for the given character code
-    int index = FT_Get_Char_Index(m_face, character);
-
-    // load the glyph for the given character into the face glyph slot,
-    // keeping the outline in original font units
+    // load the glyph into the face glyph slot, keeping the outline in
+    // original font units
     FT_Error error = FT_Load_Glyph(m_face, index, FT_LOAD_NO_SCALE);
     if (error || m_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
     {
-        cout << "FreeType ERROR: Could not find glyph outline for character "
-             << character << " (" << char(character) << ")" <<  endl;
+        cout << "FreeType ERROR: Could not find glyph outline for glyph index "
+             << index << endl;
+        return MyGlyph();
+    }
+
+    if (DEBUG_PRINT) PrintGlyphInformation(index);
+
+    return ConvertOutline(m_face->units_per_EM);
+}
+
+MyGlyph GlyphExtractor::ExtractHintedGlyph(int character, int ppem)
+{
+    return ExtractHintedGlyphByIndex(GlyphIndex(character), ppem);
+}
+
+MyGlyph GlyphExtractor::ExtractHintedGlyphByIndex(unsigned int index, int ppem)
+{
+    if (!m_face) {
+        cout << "GlyphExtractor ERROR: No font loaded!" << endl;
         return MyGlyph();
     }
 
-    if (DEBUG_PRINT) PrintGlyphInformation(character);
+    // scale the face to the requested size, then load the glyph with the
+    // font's own hinting (or the autohinter) applied to its outline
+    if (m_ppem != ppem) {
+        if (FT_Set_Pixel_Sizes(m_face, 0, ppem)) {
+            cout << "FreeType ERROR: Could not set size of " << ppem << " pixels per EM" << endl;
+            return MyGlyph();
+        }
+        m_ppem = ppem;
+    }
+    FT_Error error = FT_Load_Glyph(m_face, index, FT_LOAD_NO_BITMAP);
+    if (error || m_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+    {
+        cout << "FreeType ERROR: Could not find glyph outline for glyph index "
+             << index << endl;
+        return MyGlyph();
+    }
 
+    if (DEBUG_PRINT) PrintGlyphInformation(index);
+
+    // the hinted outline is in 26.6 fixed point pixels; bring it back to EM
+    // units so that it can be drawn like any other glyph, and straighten the
+    // curves that grid fitting has left less than a quarter pixel from flat
+    MyGlyph glyph = ConvertOutline(64.0f * ppem);
+    FlattenCurves(glyph, 0.25f / ppem);
+
+    return glyph;
+}
+
+int GlyphExtractor::VariationAxes() const
+{
+    return int(m_axisDefault.size());
+}
+
+MyGlyph GlyphExtractor::ExtractGlyphVariationByIndex(unsigned int index, const vector<float> &axes)
+{
+    if (!m_face || m_axisDefault.empty())
+        return ExtractGlyphByIndex(index);
+
+    // map each axis setting onto its design range on either side of the default
+    vector<FT_Fixed> coordinates(m_axisDefault);
+    for (size_t a = 0; a < axes.size() && a < coordinates.size(); ++a) {
+        FT_Fixed extreme = axes[a] < 0 ? m_axisMinimum[a] : m_axisMaximum[a];
+        coordinates[a] += FT_Fixed(fabs(axes[a]) * (extreme - m_axisDefault[a]));
+    }
+
+    if (FT_Set_Var_Design_Coordinates(m_face, coordinates.size(), &coordinates[0])) {
+        cout << "FreeType ERROR: Could not set variation axes" << endl;
+        return ExtractGlyphByIndex(index);
+    }
+    MyGlyph glyph = ExtractGlyphByIndex(index);
+    FT_Set_Var_Design_Coordinates(m_face, m_axisDefault.size(), &m_axisDefault[0]);
+    return glyph;
+}
+
+bool GlyphExtractor::ExtractComponentsByIndex(unsigned int index, vector<MyGlyphComponent> &components,
+                                              float &advance) const
+{
+    components.clear();
+    if (!m_face)
+        return false;
+
+    // load the glyph as it is stored, leaving a composite unflattened
+    FT_GlyphSlot slot = m_face->glyph;
+    FT_Error error = FT_Load_Glyph(m_face, index, FT_LOAD_NO_SCALE | FT_LOAD_NO_RECURSE);
+    if (error || slot->format != FT_GLYPH_FORMAT_COMPOSITE)
+        return false;
+
+    float em = m_face->units_per_EM;
+    for (FT_UInt i = 0; i < slot->num_subglyphs; ++i)
+    {
+        FT_Int component;
+        FT_UInt flags;
+        FT_Int arg1, arg2;
+        FT_Matrix transform;
+        if (FT_Get_SubGlyph_Info(slot, i, &component, &flags, &arg1, &arg2, &transform))
+            return false;
+
+        // instances can only offset and scale the component's outline
+        if (!(flags & FT_SUBGLYPH_FLAG_ARGS_ARE_XY_VALUES) || transform.xy || transform.yx
+            || transform.xx != transform.yy)
+        {
+            components.clear();
+            return false;
+        }
+
+        MyGlyphComponent placed;
+        placed.index = component;
+        placed.x = arg1 / em;
+        placed.y = arg2 / em;
+        placed.scale = transform.xx / 65536.0f;
+        components.push_back(placed);
+    }
+
+    advance = slot->advance.x / em;
+    return !components.empty();
+}
+
+// --------------------------------------------------------------------------
+
+MyGlyph GlyphExtractor::ConvertOutline(float em) const
+{
     // create a new glyph structure to populate with this character outline
     FT_Outline &outline = m_face->glyph->outline;
-    float em = m_face->units_per_EM;
     MyGlyph glyph(m_face->glyph->advance.x / em);
 
     // current point index
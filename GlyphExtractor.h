@@ -18,12 +18,15 @@
 #ifndef GLYPHEXTRACTOR_H
 #define GLYPHEXTRACTOR_H
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include "KerningTable.h"
+
 // --------------------------------------------------------------------------
 // DATA STRUCTURES: Segment, Contour, and Glyph
 
@@ -57,6 +60,28 @@ struct MyGlyph
     {}
 };
 
+// A component of a composite glyph: another glyph of the same font, placed at
+// an offset and scaled uniformly.
+struct MyGlyphComponent
+{
+    // glyph index of the component
+    unsigned int index;
+
+    // offset in EM units, and scale
+    float x, y;
+    float scale;
+
+    MyGlyphComponent() : index(0), x(0), y(0), scale(1)
+    {}
+};
+
+// Cleans up an extracted outline: drops segments that have collapsed to a
+// point, joins consecutive lines that run on within tolerance (in EM units) of
+// a straight line, and turns the contours of fonts that wind them the other way
+// round so that outer contours run clockwise. Returns the number of segments
+// removed.
+int CleanGlyph(MyGlyph &glyph, float tolerance);
+
 // --------------------------------------------------------------------------
 // This class encapsulates functionality required to load a font file from
 // disk and retrieve glyph outlines for characters from the font.
@@ -66,18 +91,84 @@ class GlyphExtractor
     FT_Library  m_library;
     FT_Face     m_face;
 
+    // advance widths of all glyphs in the face, in EM units, by glyph index
+    std::vector<float> m_advances;
+
+    // glyph index of every character in the face's charmap, read when the
+    // font is loaded: a dense table for the Basic Multilingual Plane and a
+    // sparse one for the planes above it (TrueType and CFF glyph indices fit
+    // in 16 bits)
+    std::vector<unsigned short> m_bmpIndices;
+    std::map<int, unsigned int> m_supplementaryIndices;
+
+    // kerning pairs of the face, flattened the first time they are asked
+    // for, and whether they have been read since the font was loaded
+    KerningTable m_kerning;
+    bool         m_kerningRead;
+
+    // design coordinate ranges of the face's variation axes, if it has any
+    std::vector<FT_Fixed> m_axisMinimum;
+    std::vector<FT_Fixed> m_axisDefault;
+    std::vector<FT_Fixed> m_axisMaximum;
+
+    // the pixels per EM the face is currently set to for hinting, if any
+    int m_ppem;
+
+    // converts the outline in the face's glyph slot, dividing its coordinates
+    // by the given number of units per EM
+    MyGlyph ConvertOutline(float em) const;
+
     // private methods to print font/glyph info, for debugging
     void PrintFontInformation() const;
-    void PrintGlyphInformation(int character) const;
+    void PrintGlyphInformation(unsigned int index) const;
+
+    // each extractor owns its FreeType library, so it is not copyable
+    GlyphExtractor(const GlyphExtractor &);
+    GlyphExtractor &operator=(const GlyphExtractor &);
 
 public:
     GlyphExtractor();
+    ~GlyphExtractor();
 
     // call this method first to load a font file
     bool LoadFontFile(const std::string &filename);
 
     // this method retrieves a (possibly composite) glyph for the given character
     MyGlyph ExtractGlyph(int character) const;
+
+    // these methods map a character to its glyph index (0 if the font has no
+    // glyph for it), and retrieve a glyph by index, skipping the lookup
+    unsigned int GlyphIndex(int character) const;
+    MyGlyph ExtractGlyphByIndex(unsigned int index) const;
+
+    // these methods retrieve a glyph hinted for the given pixels per EM, in EM
+    // units, with curves that are flat at that size replaced by lines; nothing
+    // is kept, so callers that want to reuse a hinted glyph keep it themselves
+    MyGlyph ExtractHintedGlyph(int character, int ppem);
+    MyGlyph ExtractHintedGlyphByIndex(unsigned int index, int ppem);
+
+    // number of variation axes of the loaded font, zero for a static font
+    int VariationAxes() const;
+
+    // this method retrieves a glyph of a variable font at the given axis
+    // setting, each axis running from -1 (its minimum) through 0 (its
+    // default) to 1 (its maximum); the face is left at its default instance
+    MyGlyph ExtractGlyphVariationByIndex(unsigned int index, const std::vector<float> &axes);
+
+    // this method retrieves the components of a composite glyph, and its
+    // advance width, without flattening it into one outline; it returns false
+    // for simple glyphs, and for composites whose components are rotated,
+    // skewed or placed by matching points
+    bool ExtractComponentsByIndex(unsigned int index, std::vector<MyGlyphComponent> &components,
+                                  float &advance) const;
+
+    // this method looks up an advance width, in EM units, from a table read
+    // when the font is loaded, without loading any outlines
+    float Advance(int character) const;
+
+    // this method gives the table of the face's kerning pairs, by glyph
+    // index, read from the font on first use as few callers need it
+    const KerningTable &KerningPairs();
 };
 
 // --------------------------------------------------------------------------
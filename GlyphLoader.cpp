@@ -0,0 +1,395 @@
+// ==========================================================================
+// Background Glyph Loading
+//
+// This module defines a GlyphLoader class that opens font files and extracts
+// glyph outlines on a thread of its own, so the render thread never waits on
+// FreeType. Each outline is also packed into the control point and index
+// block that the render thread uploads as is. Packed glyphs are handed back
+// through a lock-free queue and collected by the render thread whenever it
+// polls.
+// ==========================================================================
+
+#include "GlyphLoader.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+// converts an EM-box coordinate to fixed point, clamping to the 16-bit range
+static short QuantizeGlyphCoordinate(float value)
+{
+    float units = floor(value * GLYPH_UNITS_PER_EM + 0.5f);
+    return short(max(-32768.0f, min(32767.0f, units)));
+}
+
+// true if the masters of a variable glyph have the same contours and segments
+// as its default outline, so that their control points correspond one to one
+static bool SameTopology(const MyGlyph &glyph, const vector<MyGlyph> &masters)
+{
+    for (size_t m = 0; m < masters.size(); ++m)
+    {
+        if (masters[m].contours.size() != glyph.contours.size())
+            return false;
+        for (size_t i = 0; i < glyph.contours.size(); ++i)
+        {
+            const MyContour &a = glyph.contours[i], &b = masters[m].contours[i];
+            if (a.size() != b.size())
+                return false;
+            for (size_t j = 0; j < a.size(); ++j)
+                if (a[j].degree != b[j].degree)
+                    return false;
+        }
+    }
+    return true;
+}
+
+// quantizes control point k of segment j of contour i, followed by its offset
+// in each master (zero where there is no master)
+static void QuantizeControlPoint(const MyGlyph &glyph, const vector<MyGlyph> &masters,
+                                 size_t i, size_t j, int k, short *point)
+{
+    const MySegment &segment = glyph.contours[i][j];
+    point[0] = QuantizeGlyphCoordinate(segment.x[k]);
+    point[1] = QuantizeGlyphCoordinate(segment.y[k]);
+    for (int m = 0; m < GLYPH_DELTA_COMPONENTS / 2; ++m)
+    {
+        int dx = 0, dy = 0;
+        if (m < int(masters.size())) {
+            const MySegment &varied = masters[m].contours[i][j];
+            dx = QuantizeGlyphCoordinate(varied.x[k]) - point[0];
+            dy = QuantizeGlyphCoordinate(varied.y[k]) - point[1];
+        }
+        point[2+2*m] = short(max(-32768, min(32767, dx)));
+        point[3+2*m] = short(max(-32768, min(32767, dy)));
+    }
+}
+
+// true if control point v is the given quantized point, in every master too;
+// comparing after quantization absorbs the rounding of midpoints computed by
+// the extractor
+static bool SamePoint(const MyPackedGlyph &packed, unsigned short v, const short *point)
+{
+    if (packed.points[2*v] != point[0] || packed.points[2*v+1] != point[1])
+        return false;
+    if (packed.deltas.empty())
+        return true;
+    return equal(point + 2, point + 2 + GLYPH_DELTA_COMPONENTS, packed.deltas.begin() + v * GLYPH_DELTA_COMPONENTS);
+}
+
+bool PackGlyph(const MyGlyph &glyph, MyPackedGlyph &packed, const vector<MyGlyph> &masters)
+{
+    // a variable glyph only keeps its deltas if every master lines up with it
+    static const vector<MyGlyph> none;
+    bool variable = !masters.empty();
+    if (variable && (masters.size() > GLYPH_DELTA_COMPONENTS / 2 || !SameTopology(glyph, masters))) {
+        cout << "Glyph packing ERROR: variation masters do not match the default outline" << endl;
+        variable = false;
+    }
+    const vector<MyGlyph> &varied = variable ? masters : none;
+
+    // build a control point stream in which each segment starts at the end
+    // point of the one before it, and the last segment of a contour closes
+    // onto the first, indexing the segments of each degree separately
+    vector<unsigned short> indices[4];
+    packed.points.clear();
+    packed.deltas.clear();
+    for (size_t i = 0; i < glyph.contours.size(); ++i)
+    {
+        const MyContour &contour = glyph.contours[i];
+        unsigned short start = 0, previous = 0;
+        for (size_t j = 0; j < contour.size(); ++j)
+        {
+            int d = contour[j].degree;
+            for (int k = 0; k <= d; ++k)
+            {
+                short point[2 + GLYPH_DELTA_COMPONENTS];
+                QuantizeControlPoint(glyph, varied, i, j, k, point);
+
+                unsigned short index;
+                if (k == 0 && j > 0 && SamePoint(packed, previous, point))
+                    index = previous;
+                else if (k == d && j == contour.size() - 1 && SamePoint(packed, start, point))
+                    index = start;
+                else {
+                    if (packed.points.size() / 2 > 0xFFFF) {
+                        cout << "Glyph packing ERROR: glyph has too many control points" << endl;
+                        packed = MyPackedGlyph();
+                        return false;
+                    }
+                    index = packed.points.size() / 2;
+                    packed.points.insert(packed.points.end(), point, point + 2);
+                    if (variable)
+                        packed.deltas.insert(packed.deltas.end(), point + 2, point + 2 + GLYPH_DELTA_COMPONENTS);
+                }
+
+                if (j == 0 && k == 0) start = index;
+                indices[d].push_back(index);
+            }
+            previous = indices[d].back();
+        }
+    }
+    packed.advance = glyph.advance;
+
+    // lay the index lists out one after another
+    packed.indices.clear();
+    for (int d = 0; d < 4; ++d) {
+        packed.first[d] = packed.indices.size();
+        packed.count[d] = indices[d].size();
+        packed.indices.insert(packed.indices.end(), indices[d].begin(), indices[d].end());
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool ExtractPackedGlyph(GlyphExtractor &extractor, unsigned int index, int ppem, MyPackedGlyph &packed, int *removed)
+{
+    // clean up hinted outlines to a quarter pixel, and design outlines to
+    // half a unit of the packed coordinates; a variable font is never hinted,
+    // since hinting would fix it at its default instance and lose its deltas
+    int cleaned = 0;
+    if (removed) *removed = 0;
+    if (ppem && extractor.VariationAxes() == 0)
+    {
+        MyGlyph glyph = extractor.ExtractHintedGlyphByIndex(index, ppem);
+        cleaned = CleanGlyph(glyph, 0.25f / ppem);
+        if (removed) *removed = cleaned;
+        return PackGlyph(glyph, packed);
+    }
+
+    // a variable font also gives the outline at either end of each axis,
+    // in the order the vertex shader reads their deltas
+    vector<MyGlyph> masters;
+    int axes = min(extractor.VariationAxes(), GLYPH_VARIATION_AXES);
+    for (int a = 0; a < axes; ++a) {
+        for (int side = 1; side >= -1; side -= 2) {
+            vector<float> setting(axes, 0.0f);
+            setting[a] = float(side);
+            masters.push_back(extractor.ExtractGlyphVariationByIndex(index, setting));
+        }
+    }
+
+    // composites of a static font refer to their components rather than
+    // repeating their outlines
+    if (masters.empty())
+    {
+        vector<MyGlyphComponent> components;
+        float advance;
+        if (extractor.ExtractComponentsByIndex(index, components, advance)) {
+            packed = MyPackedGlyph();
+            packed.components.swap(components);
+            packed.advance = advance;
+            return true;
+        }
+    }
+
+    // cleanup could take a segment out of one master but not another, so
+    // variable glyphs are packed as they are
+    MyGlyph glyph = extractor.ExtractGlyphByIndex(index);
+    if (masters.empty())
+        cleaned = CleanGlyph(glyph, 0.5f / GLYPH_UNITS_PER_EM);
+    if (removed) *removed = cleaned;
+    return PackGlyph(glyph, packed, masters);
+}
+
+// --------------------------------------------------------------------------
+
+GlyphLoader::GlyphLoader()
+    : m_ready(256), m_fonts(16), m_stop(false), m_finished(false), m_notify(0), m_threadCount(0)
+{
+}
+
+GlyphLoader::~GlyphLoader()
+{
+    Stop();
+}
+
+// --------------------------------------------------------------------------
+
+void GlyphLoader::Start(const vector<MyGlyphRequest> &requests, const vector<string> &fallback,
+                        void (*notify)(), int threads)
+{
+    Stop();
+
+    m_requests = requests;
+    m_fallback.SetChain(fallback);
+    m_notify = notify;
+    m_threadCount = threads;
+    m_stop = false;
+    m_finished = false;
+    m_thread = thread(&GlyphLoader::Run, this);
+}
+
+void GlyphLoader::Stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+// --------------------------------------------------------------------------
+
+bool GlyphLoader::Poll(MyLoadedGlyph &loaded)
+{
+    return m_ready.Pop(loaded);
+}
+
+bool GlyphLoader::PollFont(MyLoadedFont &loaded)
+{
+    return m_fonts.Pop(loaded);
+}
+
+bool GlyphLoader::Finished() const
+{
+    return m_finished.load(memory_order_acquire) && m_ready.Empty() && m_fonts.Empty();
+}
+
+// --------------------------------------------------------------------------
+
+// the glyphs one font draws at one size, by glyph index, in order of first
+// appearance, each taken once whether it draws one character, several or only
+// a component
+struct MyGlyphJob
+{
+    string               font;
+    int                  ppem;
+    vector<unsigned int> indices;
+    set<unsigned int>    seen;
+
+    MyGlyphJob() : ppem(0)
+    {}
+};
+
+void GlyphLoader::Run()
+{
+    TaskScheduler scheduler(m_threadCount);
+
+    // each worker keeps its own extractor, and the font last loaded into it
+    vector<unique_ptr<GlyphExtractor> > extractors;
+    vector<string> loaded(scheduler.ThreadCount());
+    for (int w = 0; w < scheduler.ThreadCount(); ++w)
+        extractors.push_back(unique_ptr<GlyphExtractor>(new GlyphExtractor));
+
+    // publishes how text set in a font is drawn, and its kerning pairs, once
+    // per font whatever the number of sizes requested
+    set<string> published;
+    auto publish = [&](const string &name)
+    {
+        if (!published.insert(name).second)
+            return;
+        MyLoadedFont font;
+        font.font = name;
+        font.glyphs.resize(256);
+        for (int c = 0; c < 256; ++c)
+            font.glyphs[c] = m_fallback.Resolve(name, c);
+        GlyphExtractor *face = m_fallback.Face(name);
+        if (face)
+            font.kerning = face->KerningPairs();
+        while (!m_fonts.Push(std::move(font)) && !m_stop)
+            this_thread::yield();
+    };
+
+    // resolve the characters of every request to the font that draws them,
+    // publishing each run font before any glyphs, and each font that draws a
+    // glyph for the kerning between its own glyphs; characters no font can
+    // draw, because not even the run's own font opens, are skipped
+    vector<MyGlyphJob> jobs;
+    for (size_t r = 0; r < m_requests.size() && !m_stop; ++r)
+    {
+        const MyGlyphRequest &request = m_requests[r];
+        publish(request.font);
+        for (size_t i = 0; i < request.characters.size(); ++i)
+        {
+            const MyFallbackGlyph &glyph = m_fallback.Resolve(request.font, (unsigned char)request.characters[i]);
+            if (!m_fallback.Face(glyph.font))
+                continue;
+            publish(glyph.font);
+
+            size_t j = 0;
+            while (j < jobs.size() && (jobs[j].font != glyph.font || jobs[j].ppem != request.ppem)) ++j;
+            if (j == jobs.size()) {
+                jobs.push_back(MyGlyphJob());
+                jobs[j].font = glyph.font;
+                jobs[j].ppem = request.ppem;
+            }
+            if (jobs[j].seen.insert(glyph.index).second)
+                jobs[j].indices.push_back(glyph.index);
+        }
+    }
+
+    for (size_t j = 0; j < jobs.size() && !m_stop; ++j)
+    {
+        MyGlyphJob &job = jobs[j];
+        vector<unsigned int> &indices = job.indices;
+
+        // extract and pack the font's glyphs in parallel, one slot each,
+        // then the components of any composites among them, and so on
+        vector<MyLoadedGlyph> slots;
+        vector<int> removed;
+        for (size_t done = 0; done < indices.size() && !m_stop; )
+        {
+            size_t end = indices.size();
+            slots.resize(end);
+            removed.resize(end, 0);
+            scheduler.ParallelFor(end - done, [&](size_t i, int w)
+            {
+                if (m_stop) return;
+                i += done;
+                if (loaded[w] != job.font) {
+                    extractors[w]->LoadFontFile(job.font);
+                    loaded[w] = job.font;
+                }
+                slots[i].font = job.font;
+                slots[i].index = indices[i];
+                slots[i].ppem = job.ppem;
+                ExtractPackedGlyph(*extractors[w], indices[i], job.ppem, slots[i].glyph, &removed[i]);
+            });
+
+            for (size_t i = done; i < end; ++i) {
+                const vector<MyGlyphComponent> &parts = slots[i].glyph.components;
+                for (size_t c = 0; c < parts.size(); ++c)
+                    if (job.seen.insert(parts[c].index).second)
+                        indices.push_back(parts[c].index);
+            }
+            done = end;
+        }
+
+        // report what cleanup took out of the font's outlines
+        int before = 0, after = 0;
+        for (size_t i = 0; i < slots.size(); ++i) {
+            for (int d = 1; d < 4; ++d)
+                after += slots[i].glyph.count[d] / (d + 1);
+            before += removed[i];
+        }
+        before += after;
+        if (!m_stop)
+            cout << "Outline cleanup: " << job.font << ": " << before << " segments, "
+                 << after << " after" << endl;
+
+        // publish in request order
+        for (size_t i = 0; i < slots.size() && !m_stop; ++i)
+        {
+            // the render thread drains the queue every frame, so a full
+            // queue only ever means waiting a frame
+            while (!m_ready.Push(std::move(slots[i])) && !m_stop)
+                this_thread::yield();
+
+            if (m_notify) m_notify();
+        }
+    }
+
+    if (!m_stop) {
+        cout << "Glyph workers: " << scheduler.ThreadCount() << " threads, "
+             << scheduler.Steals() << " steals" << endl;
+        cout << "Font fallback: " << m_fallback.Probes() << " probes, " << m_fallback.Hits()
+             << " memoized lookups" << endl;
+    }
+    m_finished.store(true, memory_order_release);
+}
+
+// --------------------------------------------------------------------------
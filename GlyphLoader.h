@@ -0,0 +1,182 @@
+// ==========================================================================
+// Background Glyph Loading
+//
+// This module defines a GlyphLoader class that opens font files and extracts
+// glyph outlines on a thread of its own, so the render thread never waits on
+// FreeType. Each outline is also packed into the control point and index
+// block that the render thread uploads as is. Packed glyphs are handed back
+// through a lock-free queue and collected by the render thread whenever it
+// polls.
+//
+// The glyphs of each font are extracted and packed in parallel on a
+// work-stealing scheduler, each into a slot of its own, and published in
+// request order once the whole font is done, so the results do not depend on
+// the number of threads. Every worker has its own GlyphExtractor, and with it
+// its own FreeType library instance, since FreeType objects must not be
+// shared across threads without locking.
+//
+// Characters a request's font lacks are resolved through a fallback chain on
+// the loader thread as well, and extracted from the font that has them; each
+// font is published with how every character of text set in it is drawn, so
+// the render thread never opens a font to lay out text.
+// ==========================================================================
+#ifndef GLYPHLOADER_H
+#define GLYPHLOADER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FontFallback.h"
+#include "GlyphExtractor.h"
+#include "SpscQueue.h"
+
+// --------------------------------------------------------------------------
+// DATA STRUCTURES: packed glyphs, requests and results
+
+// fixed point units per EM of packed control points, giving a range of +/-4
+// EM around the origin
+const float GLYPH_UNITS_PER_EM = 8192.0f;
+
+// variation axes a packed glyph can carry; each has a delta stream for its
+// maximum and one for its minimum, two components each
+const int GLYPH_VARIATION_AXES = 2;
+const int GLYPH_DELTA_COMPONENTS = 4 * GLYPH_VARIATION_AXES;
+
+// A glyph's control points in 16-bit fixed point, with endpoints shared
+// between consecutive segments of a contour, and an index list per segment
+// degree packed one after another.
+struct MyPackedGlyph
+{
+    // x, y pairs of control points
+    std::vector<short> points;
+
+    // for a glyph of a variable font, GLYPH_DELTA_COMPONENTS offsets per
+    // control point: the x, y offset at each axis maximum then minimum, axis
+    // by axis; empty for a static glyph
+    std::vector<short> deltas;
+
+    // for a composite glyph, the glyphs it is drawn as, in which case it has
+    // no control points of its own
+    std::vector<MyGlyphComponent> components;
+
+    // index lists of all degrees, and where each degree's list starts
+    std::vector<unsigned short> indices;
+    int first[4];
+    int count[4];
+
+    // advance width to next glyph, in EM units
+    float advance;
+
+    MyPackedGlyph() : advance(0)
+    {
+        for (int d = 0; d < 4; ++d) { first[d] = 0; count[d] = 0; }
+    }
+};
+
+// packs an extracted outline, returning false if it has too many points; the
+// outlines of a variable glyph at the maximum and minimum of each axis, in
+// that order, may be given to pack their offsets from it as well
+bool PackGlyph(const MyGlyph &glyph, MyPackedGlyph &packed,
+               const std::vector<MyGlyph> &masters = std::vector<MyGlyph>());
+
+// extracts, cleans up and packs a glyph, by glyph index, from the font loaded
+// into the extractor: hinted for ppem pixels per EM if
+// nonzero and the font is static, or else its design outline, along with the
+// outlines at the ends of up to GLYPH_VARIATION_AXES axes for a variable font,
+// or just its components for a composite of a static font; removed (if given)
+// receives the number of segments that cleanup took out
+bool ExtractPackedGlyph(GlyphExtractor &extractor, unsigned int index, int ppem, MyPackedGlyph &packed,
+                        int *removed = 0);
+
+// the characters of text set in one font file, hinted at the given pixels per
+// EM or, if zero, with their design outlines; characters the font lacks are
+// taken from the fallback chain
+struct MyGlyphRequest
+{
+    std::string font;
+    std::string characters;
+    int         ppem;
+};
+
+// a packed glyph, tagged with where it came from; glyphs go by index rather
+// than character, so that a glyph drawn both for a character and as a
+// component of a composite is only extracted once
+struct MyLoadedGlyph
+{
+    std::string   font;
+    unsigned int  index;
+    int           ppem;
+    MyPackedGlyph glyph;
+
+    MyLoadedGlyph() : index(0), ppem(0)
+    {}
+};
+
+// how text set in a font is drawn, and the font's kerning pairs, published
+// before any glyphs so that text can be laid out before its outlines arrive
+struct MyLoadedFont
+{
+    std::string font;
+
+    // the font, glyph index and advance that each 8-bit character code of
+    // text set in this font is drawn with, resolved through the fallback chain
+    std::vector<MyFallbackGlyph> glyphs;
+
+    // the font's kerning pairs, by glyph index
+    KerningTable kerning;
+};
+
+// --------------------------------------------------------------------------
+
+class GlyphLoader
+{
+    std::vector<MyGlyphRequest> m_requests;
+    SpscQueue<MyLoadedGlyph>    m_ready;
+    SpscQueue<MyLoadedFont>     m_fonts;
+
+    // resolves characters to the fonts that draw them; only touched by the
+    // loader thread once started
+    FontFallback m_fallback;
+
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_finished;
+    std::thread       m_thread;
+
+    // called from the loader thread after each glyph is published
+    void (*m_notify)();
+
+    // workers extracting and packing glyphs, or zero for one per core
+    int m_threadCount;
+
+    void Run();
+
+    GlyphLoader(const GlyphLoader &);
+    GlyphLoader &operator=(const GlyphLoader &);
+
+public:
+    GlyphLoader();
+    ~GlyphLoader();
+
+    // starts extracting the requested glyphs, in order, on the loader thread
+    // and the given number of workers (zero for one per core), drawing
+    // characters a request's font lacks from the fallback fonts, in order;
+    // notify (if given) must be safe to call from any thread
+    void Start(const std::vector<MyGlyphRequest> &requests, const std::vector<std::string> &fallback,
+               void (*notify)() = 0, int threads = 0);
+
+    // render thread: takes one packed glyph, or one font's layout tables, if
+    // any is waiting
+    bool Poll(MyLoadedGlyph &loaded);
+    bool PollFont(MyLoadedFont &loaded);
+
+    // true once every request has been packed and collected
+    bool Finished() const;
+
+    // abandons any remaining requests and waits for the thread to exit
+    void Stop();
+};
+
+// --------------------------------------------------------------------------
+#endif // GLYPHLOADER_H
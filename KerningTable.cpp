@@ -0,0 +1,355 @@
+// ==========================================================================
+// Kerning Pair Table
+//
+// This module defines a KerningTable class that flattens the kerning pairs of
+// a font into an open-addressing hash keyed by glyph-index pairs.
+// ==========================================================================
+
+#include "KerningTable.h"
+#include <set>
+#include <utility>
+
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Big-endian readers for sfnt table data; anything past the end of the table
+// reads as zero, so a truncated or malformed table yields no pairs rather than
+// reading out of bounds.
+
+static unsigned int U16(const vector<unsigned char> &data, size_t offset)
+{
+    if (offset + 2 > data.size()) return 0;
+    return data[offset] << 8 | data[offset+1];
+}
+
+static int S16(const vector<unsigned char> &data, size_t offset)
+{
+    return short(U16(data, offset));
+}
+
+static unsigned int U32(const vector<unsigned char> &data, size_t offset)
+{
+    return U16(data, offset) << 16 | U16(data, offset + 2);
+}
+
+// the whole of one sfnt table of a face, or nothing if the face lacks it
+static vector<unsigned char> LoadTable(FT_Face face, FT_ULong tag)
+{
+    vector<unsigned char> data;
+    FT_ULong length = 0;
+    if (!FT_IS_SFNT(face) || FT_Load_Sfnt_Table(face, tag, 0, 0, &length) || length == 0)
+        return data;
+    data.resize(length);
+    if (FT_Load_Sfnt_Table(face, tag, 0, &data[0], &length))
+        data.clear();
+    return data;
+}
+
+// size in bytes of a GPOS value record of the given format (one 16-bit field
+// per bit set), and the offset of its X advance field within it
+static size_t ValueRecordSize(unsigned int format)
+{
+    size_t size = 0;
+    for (unsigned int bit = 1; bit < 0x100; bit <<= 1)
+        if (format & bit) size += 2;
+    return size;
+}
+
+static size_t XAdvanceOffset(unsigned int format)
+{
+    return ValueRecordSize(format & 0x3);
+}
+
+// the glyphs of a coverage table, in coverage index order
+static vector<unsigned int> CoverageGlyphs(const vector<unsigned char> &data, size_t offset)
+{
+    vector<unsigned int> glyphs;
+    unsigned int format = U16(data, offset);
+    unsigned int count = U16(data, offset + 2);
+    if (format == 1) {
+        for (unsigned int i = 0; i < count; ++i)
+            glyphs.push_back(U16(data, offset + 4 + 2*i));
+    }
+    else if (format == 2) {
+        for (unsigned int i = 0; i < count; ++i) {
+            size_t range = offset + 4 + 6*i;
+            unsigned int first = U16(data, range), last = U16(data, range + 2);
+            for (unsigned int g = first; g <= last && g >= first; ++g)
+                glyphs.push_back(g);
+        }
+    }
+    return glyphs;
+}
+
+// the glyphs a class definition table assigns a class other than zero, with
+// their classes
+static vector<pair<unsigned int, unsigned int> > ClassGlyphs(const vector<unsigned char> &data, size_t offset)
+{
+    vector<pair<unsigned int, unsigned int> > glyphs;
+    unsigned int format = U16(data, offset);
+    if (format == 1) {
+        unsigned int start = U16(data, offset + 2);
+        unsigned int count = U16(data, offset + 4);
+        for (unsigned int i = 0; i < count; ++i) {
+            unsigned int c = U16(data, offset + 6 + 2*i);
+            if (c) glyphs.push_back(make_pair(start + i, c));
+        }
+    }
+    else if (format == 2) {
+        unsigned int count = U16(data, offset + 2);
+        for (unsigned int i = 0; i < count; ++i) {
+            size_t range = offset + 4 + 6*i;
+            unsigned int first = U16(data, range), last = U16(data, range + 2);
+            unsigned int c = U16(data, range + 4);
+            for (unsigned int g = first; c && g <= last && g >= first; ++g)
+                glyphs.push_back(make_pair(g, c));
+        }
+    }
+    return glyphs;
+}
+
+// --------------------------------------------------------------------------
+
+KerningTable::KerningTable()
+    : m_count(0), m_shift(32), m_discard()
+{
+}
+
+void KerningTable::Clear()
+{
+    m_slots.clear();
+    m_count = 0;
+    m_shift = 32;
+}
+
+void KerningTable::Grow()
+{
+    vector<Slot> slots;
+    slots.swap(m_slots);
+
+    size_t size = slots.empty() ? 64 : 2 * slots.size();
+    Slot empty = { EMPTY_KEY, 0.0f };
+    m_slots.assign(size, empty);
+    m_shift = 32;
+    while (size > 1) { size >>= 1; m_shift--; }
+
+    size_t mask = m_slots.size() - 1;
+    for (size_t s = 0; s < slots.size(); ++s) {
+        if (slots[s].key == EMPTY_KEY) continue;
+        size_t i = Home(slots[s].key);
+        while (m_slots[i].key != EMPTY_KEY)
+            i = (i + 1) & mask;
+        m_slots[i] = slots[s];
+    }
+}
+
+KerningTable::Slot &KerningTable::Entry(unsigned int left, unsigned int right)
+{
+    if (2 * (m_count + 1) > m_slots.size())
+        Grow();
+
+    // the one pair that cannot be told from an empty slot is never kerned
+    unsigned int key = Key(left, right);
+    if (key == EMPTY_KEY) {
+        m_discard.adjustment = 0.0f;
+        return m_discard;
+    }
+
+    size_t mask = m_slots.size() - 1;
+    size_t i = Home(key);
+    while (m_slots[i].key != key && m_slots[i].key != EMPTY_KEY)
+        i = (i + 1) & mask;
+    if (m_slots[i].key == EMPTY_KEY) {
+        m_slots[i].key = key;
+        m_slots[i].adjustment = 0.0f;
+        m_count++;
+    }
+    return m_slots[i];
+}
+
+bool KerningTable::Contains(unsigned int left, unsigned int right) const
+{
+    if (m_count == 0)
+        return false;
+    unsigned int key = Key(left, right);
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = Home(key); ; i = (i + 1) & mask) {
+        if (m_slots[i].key == key) return true;
+        if (m_slots[i].key == EMPTY_KEY) return false;
+    }
+}
+
+void KerningTable::Accumulate(const KerningTable &other)
+{
+    // grow to the final size first: the other table's slots come in hash
+    // order, which would pile up at the front of a smaller table
+    while (2 * (m_count + other.m_count) > m_slots.size())
+        Grow();
+    for (size_t s = 0; s < other.m_slots.size(); ++s) {
+        unsigned int key = other.m_slots[s].key;
+        if (key != EMPTY_KEY && other.m_slots[s].adjustment != 0.0f)
+            Entry(key >> 16, key & 0xffff).adjustment += other.m_slots[s].adjustment;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+size_t KerningTable::Read(FT_Face face)
+{
+    Clear();
+    float em = face->units_per_EM;
+    if (em <= 0)
+        return 0;
+
+    // a font that kerns through GPOS keeps its legacy table only for old
+    // software, so the legacy table is read only if GPOS has no pairs
+    ReadPairPositioning(LoadTable(face, TTAG_GPOS), em);
+    if (m_count == 0)
+        ReadKernTable(LoadTable(face, TTAG_kern), em);
+    return m_count;
+}
+
+// Reads the X advance adjustments of the first glyph of each pair from the pair
+// adjustment lookups (type 2, possibly behind an extension lookup) of every
+// 'kern' feature in the font. Within a lookup the first subtable that covers a
+// pair decides it; the adjustments of separate lookups add up. Other value
+// record fields, and class pairs whose second class is class zero, are left
+// out.
+void KerningTable::ReadPairPositioning(const vector<unsigned char> &gpos, float em)
+{
+    if (gpos.size() < 10 || U16(gpos, 0) != 1)
+        return;
+    size_t features = U16(gpos, 6);
+    size_t lookups = U16(gpos, 8);
+
+    // lookups of the 'kern' feature of any script and language, in the order
+    // the font applies them
+    set<unsigned int> kernLookups;
+    unsigned int featureCount = U16(gpos, features);
+    for (unsigned int f = 0; f < featureCount; ++f) {
+        size_t record = features + 2 + 6*f;
+        if (U32(gpos, record) != TTAG_kern) continue;
+        size_t feature = features + U16(gpos, record + 4);
+        unsigned int count = U16(gpos, feature + 2);
+        for (unsigned int l = 0; l < count; ++l)
+            kernLookups.insert(U16(gpos, feature + 4 + 2*l));
+    }
+
+    unsigned int lookupCount = U16(gpos, lookups);
+    for (set<unsigned int>::iterator l = kernLookups.begin(); l != kernLookups.end(); ++l)
+    {
+        if (*l >= lookupCount) continue;
+        size_t lookup = lookups + U16(gpos, lookups + 2 + 2*(*l));
+        unsigned int type = U16(gpos, lookup);
+        unsigned int subtableCount = U16(gpos, lookup + 4);
+
+        // the pairs of this lookup, including those a pair list claims with an
+        // adjustment of zero, and the first glyphs a class subtable has
+        // claimed every pair of
+        KerningTable pairs;
+        vector<bool> closed(0x10000, false);
+        for (unsigned int s = 0; s < subtableCount; ++s)
+        {
+            size_t subtable = lookup + U16(gpos, lookup + 6 + 2*s);
+            if (type == 9) {
+                if (U16(gpos, subtable) != 1 || U16(gpos, subtable + 2) != 2) continue;
+                subtable += U32(gpos, subtable + 4);
+            }
+            else if (type != 2) continue;
+
+            unsigned int format = U16(gpos, subtable);
+            vector<unsigned int> firsts = CoverageGlyphs(gpos, subtable + U16(gpos, subtable + 2));
+            unsigned int format1 = U16(gpos, subtable + 4);
+            unsigned int format2 = U16(gpos, subtable + 6);
+            size_t size1 = ValueRecordSize(format1), size2 = ValueRecordSize(format2);
+            bool advance = (format1 & 0x4) != 0;
+            size_t field = XAdvanceOffset(format1);
+
+            if (format == 1)
+            {
+                // a list of second glyphs and value records for each first glyph
+                unsigned int setCount = U16(gpos, subtable + 8);
+                for (unsigned int i = 0; i < firsts.size() && i < setCount; ++i) {
+                    if (closed[firsts[i] & 0xffff]) continue;
+                    size_t pairSet = subtable + U16(gpos, subtable + 10 + 2*i);
+                    unsigned int count = U16(gpos, pairSet);
+                    size_t stride = 2 + size1 + size2;
+                    for (unsigned int p = 0; p < count; ++p) {
+                        size_t record = pairSet + 2 + stride*p;
+                        unsigned int second = U16(gpos, record);
+                        if (pairs.Contains(firsts[i], second)) continue;
+                        int value = advance ? S16(gpos, record + 2 + field) : 0;
+                        pairs.Entry(firsts[i], second).adjustment = value / em;
+                    }
+                }
+            }
+            else if (format == 2)
+            {
+                // a matrix of value records by the classes of the two glyphs
+                vector<pair<unsigned int, unsigned int> > classes1 =
+                    ClassGlyphs(gpos, subtable + U16(gpos, subtable + 8));
+                vector<pair<unsigned int, unsigned int> > classes2 =
+                    ClassGlyphs(gpos, subtable + U16(gpos, subtable + 10));
+                unsigned int class1Count = U16(gpos, subtable + 12);
+                unsigned int class2Count = U16(gpos, subtable + 14);
+                size_t stride = size1 + size2;
+
+                vector<unsigned int> classOf(0x10000, 0);
+                for (size_t i = 0; i < classes1.size(); ++i)
+                    classOf[classes1[i].first & 0xffff] = classes1[i].second;
+                for (size_t i = 0; i < firsts.size(); ++i) {
+                    unsigned int class1 = classOf[firsts[i] & 0xffff];
+                    if (closed[firsts[i] & 0xffff] || class1 >= class1Count) continue;
+                    closed[firsts[i] & 0xffff] = true;
+                    for (size_t j = 0; j < classes2.size(); ++j) {
+                        unsigned int second = classes2[j].first, class2 = classes2[j].second;
+                        if (class2 >= class2Count) continue;
+                        if (pairs.Contains(firsts[i], second)) continue;
+                        size_t record = subtable + 16 + stride * (class1 * class2Count + class2);
+                        int value = advance ? S16(gpos, record + field) : 0;
+                        if (value)
+                            pairs.Entry(firsts[i], second).adjustment = value / em;
+                    }
+                }
+            }
+        }
+        Accumulate(pairs);
+    }
+}
+
+// Reads the format 0 subtables of a legacy (version 0) 'kern' table that kern
+// horizontally; the values of successive subtables add up, unless a subtable
+// overrides them.
+void KerningTable::ReadKernTable(const vector<unsigned char> &kern, float em)
+{
+    if (kern.size() < 4 || U16(kern, 0) != 0)
+        return;
+
+    unsigned int tableCount = U16(kern, 2);
+    size_t subtable = 4;
+    for (unsigned int t = 0; t < tableCount && subtable < kern.size(); ++t)
+    {
+        unsigned int length = U16(kern, subtable + 2);
+        unsigned int coverage = U16(kern, subtable + 4);
+        bool horizontal = (coverage & 0x1) != 0;
+        bool minimum = (coverage & 0x2) != 0, crossStream = (coverage & 0x4) != 0;
+        bool replace = (coverage & 0x8) != 0;
+        if ((coverage >> 8) == 0 && horizontal && !minimum && !crossStream)
+        {
+            unsigned int count = U16(kern, subtable + 6);
+            for (unsigned int p = 0; p < count; ++p) {
+                size_t record = subtable + 14 + 6*p;
+                Slot &slot = Entry(U16(kern, record), U16(kern, record + 2));
+                float value = S16(kern, record + 4) / em;
+                slot.adjustment = replace ? value : slot.adjustment + value;
+            }
+        }
+        if (length < 6) break;
+        subtable += length;
+    }
+}
+
+// --------------------------------------------------------------------------
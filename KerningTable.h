@@ -0,0 +1,97 @@
+// ==========================================================================
+// Kerning Pair Table
+//
+// This module defines a KerningTable class that holds every kerning pair of a
+// font in one flat open-addressing hash, keyed by the glyph indices of the
+// pair. The pairs are gathered once per font, from the pair adjustment lookups
+// of the font's GPOS 'kern' feature, or from its legacy 'kern' table if it has
+// no such feature, so that laying out a line is one probe into a small array
+// per pair rather than a walk through the font's tables.
+// ==========================================================================
+#ifndef KERNINGTABLE_H
+#define KERNINGTABLE_H
+
+#include <cstddef>
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+// --------------------------------------------------------------------------
+
+class KerningTable
+{
+    // a slot of the hash: the pair as (left << 16 | right), or EMPTY_KEY, and
+    // the adjustment to the pen between the two glyphs, in EM units
+    struct Slot
+    {
+        unsigned int key;
+        float        adjustment;
+    };
+    static const unsigned int EMPTY_KEY = 0xffffffffu;
+
+    // a power-of-two number of slots, kept at most half full, so that a probe
+    // for a pair the font does not kern stops after a slot or two
+    std::vector<Slot> m_slots;
+    std::size_t       m_count;
+    unsigned int      m_shift;
+
+    // where pairs that have no key are written, and dropped
+    Slot              m_discard;
+
+    static unsigned int Key(unsigned int left, unsigned int right)
+    {
+        return (left & 0xffff) << 16 | (right & 0xffff);
+    }
+
+    // the slot a key hashes to: Fibonacci hashing, taking the top bits of the
+    // product so that both glyphs of the pair take part
+    std::size_t Home(unsigned int key) const
+    {
+        return std::size_t((key * 0x9e3779b1u) >> m_shift);
+    }
+
+    // the slot holding a pair, adding an empty one if the pair is new
+    Slot &Entry(unsigned int left, unsigned int right);
+    bool Contains(unsigned int left, unsigned int right) const;
+    void Grow();
+
+    // adds the pairs of another table to this one, summing the adjustments of
+    // pairs found in both
+    void Accumulate(const KerningTable &other);
+
+    // readers for the two tables pairs are taken from
+    void ReadPairPositioning(const std::vector<unsigned char> &gpos, float em);
+    void ReadKernTable(const std::vector<unsigned char> &kern, float em);
+
+public:
+    KerningTable();
+
+    // replaces the table with the kerning pairs of a face, returning the
+    // number of pairs read
+    std::size_t Read(FT_Face face);
+
+    void Clear();
+
+    std::size_t Size() const { return m_count; }
+
+    // the adjustment between two glyphs, by glyph index, in EM units; zero for
+    // pairs the font does not kern
+    float Lookup(unsigned int left, unsigned int right) const
+    {
+        if (m_count == 0)
+            return 0.0f;
+        unsigned int key = Key(left, right);
+        std::size_t mask = m_slots.size() - 1;
+        for (std::size_t i = Home(key); ; i = (i + 1) & mask) {
+            const Slot &slot = m_slots[i];
+            if (slot.key == key)
+                return slot.adjustment;
+            if (slot.key == EMPTY_KEY)
+                return 0.0f;
+        }
+    }
+};
+
+// --------------------------------------------------------------------------
+#endif // KERNINGTABLE_H
@@ -0,0 +1,67 @@
+// ==========================================================================
+// Lock-free single-producer, single-consumer queue
+//
+// A fixed-capacity ring buffer for handing items from exactly one thread to
+// exactly one other. The producer only ever writes the tail and the consumer
+// only ever writes the head, so neither side takes a lock: each publishes
+// its index with release ordering after touching the slot, and reads the
+// other side's index with acquire ordering before touching it.
+// ==========================================================================
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SpscQueue
+{
+    // one slot is always left empty to tell a full queue from an empty one
+    std::vector<T>           m_slots;
+    std::atomic<std::size_t> m_head;
+    std::atomic<std::size_t> m_tail;
+
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+public:
+    explicit SpscQueue(std::size_t capacity)
+        : m_slots(capacity + 1), m_head(0), m_tail(0)
+    {}
+
+    // producer side: returns false without blocking if the queue is full
+    bool Push(T &&item)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        std::size_t next = (tail + 1) % m_slots.size();
+        if (next == m_head.load(std::memory_order_acquire))
+            return false;
+
+        m_slots[tail] = std::move(item);
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side: returns false without blocking if the queue is empty
+    bool Pop(T &item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(m_slots[head]);
+        m_head.store((head + 1) % m_slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    // either side: true if nothing is waiting (may be stale by the time it returns)
+    bool Empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+};
+
+// --------------------------------------------------------------------------
+#endif // SPSCQUEUE_H
@@ -0,0 +1,128 @@
+// ==========================================================================
+// Work-Stealing Task Scheduler
+//
+// This module defines a TaskScheduler class that runs the iterations of a
+// parallel loop on a fixed pool of worker threads. Each worker starts with a
+// contiguous share of the iterations in a deque of its own, takes work from
+// the back of it, and once it runs dry steals from the front of the other
+// workers' deques.
+// ==========================================================================
+
+#include "TaskScheduler.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+TaskScheduler::TaskScheduler(int threads)
+    : m_remaining(0), m_generation(0), m_stop(false), m_steals(0)
+{
+    if (threads <= 0) threads = thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+
+    for (int w = 0; w < threads; ++w)
+        m_workers.push_back(unique_ptr<Worker>(new Worker));
+    for (int w = 0; w < threads; ++w)
+        m_threads.push_back(thread(&TaskScheduler::Run, this, w));
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        lock_guard<mutex> guard(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (size_t t = 0; t < m_threads.size(); ++t)
+        m_threads[t].join();
+}
+
+// --------------------------------------------------------------------------
+
+void TaskScheduler::ParallelFor(size_t count, const Body &body)
+{
+    if (count == 0) return;
+
+    unique_lock<mutex> guard(m_mutex);
+
+    // count the tasks before queueing any, as a worker still draining the
+    // deques after the previous call may take and finish one at once
+    m_remaining = count;
+
+    // hand each worker a contiguous share, so that neighbouring iterations
+    // tend to run on the same worker unless stolen
+    size_t workers = m_workers.size();
+    for (size_t w = 0; w < workers; ++w)
+    {
+        lock_guard<mutex> deque(m_workers[w]->lock);
+        for (size_t i = w * count / workers; i < (w + 1) * count / workers; ++i) {
+            Task task = { i, &body };
+            m_workers[w]->tasks.push_back(task);
+        }
+    }
+
+    m_generation++;
+    m_wake.notify_all();
+
+    m_done.wait(guard, [this] { return m_remaining == 0; });
+}
+
+// --------------------------------------------------------------------------
+
+bool TaskScheduler::Take(int worker, Task &task)
+{
+    // own work first, newest first
+    {
+        Worker &own = *m_workers[worker];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // then the oldest work of the others
+    int workers = int(m_workers.size());
+    for (int i = 1; i < workers; ++i)
+    {
+        Worker &victim = *m_workers[(worker + i) % workers];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            m_steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::Run(int worker)
+{
+    unsigned int seen = 0;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> guard(m_mutex);
+            m_wake.wait(guard, [&] { return m_stop || m_generation != seen; });
+            if (m_stop) return;
+            seen = m_generation;
+        }
+
+        // tasks of a new call may be taken before this worker is woken for
+        // it, which is harmless as they are counted before being queued; once
+        // none can be taken the rest are already running elsewhere
+        Task task;
+        while (Take(worker, task))
+        {
+            (*task.body)(task.index, worker);
+            if (--m_remaining == 0) {
+                lock_guard<mutex> guard(m_mutex);
+                m_done.notify_all();
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
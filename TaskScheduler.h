@@ -0,0 +1,83 @@
+// ==========================================================================
+// Work-Stealing Task Scheduler
+//
+// This module defines a TaskScheduler class that runs the iterations of a
+// parallel loop on a fixed pool of worker threads. Each worker starts with a
+// contiguous share of the iterations in a deque of its own, takes work from
+// the back of it, and once it runs dry steals from the front of the other
+// workers' deques, so uneven iterations still keep every core busy.
+//
+// Iterations are identified by index and should write their results to a
+// slot of their own, which keeps results independent of the thread count
+// and of which worker ran what.
+// ==========================================================================
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskScheduler
+{
+public:
+    // the loop body, given the iteration index and the index of the worker
+    // running it (for per-worker scratch state)
+    typedef std::function<void(std::size_t, int)> Body;
+
+private:
+    // one iteration of a loop; tasks carry their loop's body, since a worker
+    // may still be looking for work when the next loop is queued
+    struct Task
+    {
+        std::size_t index;
+        const Body *body;
+    };
+
+    struct Worker
+    {
+        std::mutex       lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    std::vector<std::thread>              m_threads;
+
+    // the loop being run, and how many of its iterations are still to finish
+    std::mutex               m_mutex;
+    std::condition_variable  m_wake;
+    std::condition_variable  m_done;
+    std::atomic<std::size_t> m_remaining;
+    unsigned int             m_generation;
+    bool                     m_stop;
+
+    // statistics, for reporting
+    std::atomic<unsigned int> m_steals;
+
+    void Run(int worker);
+    bool Take(int worker, Task &task);
+
+    TaskScheduler(const TaskScheduler &);
+    TaskScheduler &operator=(const TaskScheduler &);
+
+public:
+    // starts the given number of workers, or one per hardware thread if zero
+    explicit TaskScheduler(int threads = 0);
+    ~TaskScheduler();
+
+    int ThreadCount() const { return int(m_workers.size()); }
+    unsigned int Steals() const { return m_steals; }
+
+    // runs body for every index in [0, count) and waits for all to finish;
+    // to be called from one thread at a time
+    void ParallelFor(std::size_t count, const Body &body);
+};
+
+// --------------------------------------------------------------------------
+#endif // TASKSCHEDULER_H
@@ -15,7 +15,16 @@
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "FontCatalog.h"
+#include "FontFallback.h"
 #include "GlyphExtractor.h"
+#include "GlyphLoader.h"
+#include "SpscQueue.h"
 
 // specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
@@ -27,7 +36,18 @@
 #include <GLFW/glfw3.h>
 
 static int level = 1; // Level of program
-static float rate = 0.01; // rate of movement
+static float rate = 0.01; // rate of movement per animation step
+static int swapInterval = 1; // buffer swaps wait this many vertical blanks, 0 for uncapped
+static bool reportPacing = false; // print frame pacing statistics at the next frame
+static bool captureCurves = true; // replay static levels from transform feedback
+static bool renderOnDemand = true; // only redraw static levels when something changes
+static bool redraw = true; // set by anything that changes what is on screen
+static bool sweepAxes = false; // animate the variation axes of variable fonts
+static bool reportGlyphs = false; // print glyph cache statistics at the next frame
+
+// The settings above belong to the render loop. GLFW callbacks never touch
+// them directly; they queue input events, which the loop applies at the
+// start of each iteration.
 
 
 /*
@@ -43,11 +63,87 @@ using namespace std;
 
 void QueryGLVersion();
 bool CheckGLErrors();
+void InitializeDebugOutput();
 
 string LoadSource(const string &filename);
 GLuint CompileShader(GLenum shaderType, const string &source);
 GLuint LinkProgram(GLuint vertexShader, GLuint TCSshader, GLuint TESshader, GLuint fragmentShader);
 GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
+
+// --------------------------------------------------------------------------
+// Redundant state elision
+//
+// All program, vertex array, patch size and uniform changes go through these
+// functions, which remember what is currently set and only call into OpenGL
+// when a value actually changes. Drawing functions therefore leave their
+// state bound instead of resetting it to default after each draw.
+
+struct MyStateCache
+{
+	// currently bound program and vertex array object, and patch size
+	GLuint program;
+	GLuint vertexArray;
+	GLint  patchVertices;
+
+	// vec2 uniform values, keyed by program and location
+	map<pair<GLuint, GLint>, pair<GLfloat, GLfloat> > uniforms;
+
+	// state calls passed on to OpenGL and skipped, this frame and the last
+	unsigned int issued, elided;
+	unsigned int lastIssued, lastElided;
+
+	MyStateCache() : program(0), vertexArray(0), patchVertices(3),
+		issued(0), elided(0), lastIssued(0), lastElided(0)
+	{}
+};
+
+static MyStateCache glState;
+
+void UseProgram(GLuint program)
+{
+	if (glState.program == program) { glState.elided++; return; }
+	glUseProgram(program);
+	glState.program = program;
+	glState.issued++;
+}
+
+void BindVertexArray(GLuint vertexArray)
+{
+	if (glState.vertexArray == vertexArray) { glState.elided++; return; }
+	glBindVertexArray(vertexArray);
+	glState.vertexArray = vertexArray;
+	glState.issued++;
+}
+
+void PatchVertices(GLint count)
+{
+	if (glState.patchVertices == count) { glState.elided++; return; }
+	glPatchParameteri(GL_PATCH_VERTICES, count);
+	glState.patchVertices = count;
+	glState.issued++;
+}
+
+// sets a vec2 uniform of the currently bound program
+void Uniform2f(GLint location, GLfloat x, GLfloat y)
+{
+	if (location < 0) return;
+
+	pair<GLuint, GLint> key(glState.program, location);
+	map<pair<GLuint, GLint>, pair<GLfloat, GLfloat> >::iterator it = glState.uniforms.find(key);
+	if (it != glState.uniforms.end() && it->second == make_pair(x, y)) { glState.elided++; return; }
+
+	glUniform2f(location, x, y);
+	glState.uniforms[key] = make_pair(x, y);
+	glState.issued++;
+}
+
+// starts counting state calls for a new frame
+void BeginStateFrame()
+{
+	glState.lastIssued = glState.issued;
+	glState.lastElided = glState.elided;
+	glState.issued = glState.elided = 0;
+}
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL shader programs for rendering
 
@@ -61,9 +157,22 @@ struct MyShader
 	GLuint  program;
 	GLuint  programNoTess;
 
+	// uniform locations in each program, the translation applied to
+	// everything drawn (used to scroll baked text), and the setting of the
+	// variation axes of variable font glyphs
+	GLint   curvesLocation;
+	GLint   offsetLocation;
+	GLint   offsetLocationNoTess;
+	GLint   variationLocation;
+	GLint   variationLocationNoTess;
+	GLfloat offset[2];
+	GLfloat variation[2];
+
 	// initialize shader and program names to zero (OpenGL reserved value)
-	MyShader() : vertex(0), fragment(0),  program(0), programNoTess(0)
-	{}
+	MyShader() : vertex(0), fragment(0),  program(0), programNoTess(0),
+		curvesLocation(-1), offsetLocation(-1), offsetLocationNoTess(-1),
+		variationLocation(-1), variationLocationNoTess(-1)
+	{ offset[0] = offset[1] = 0.0f; variation[0] = variation[1] = 0.0f; }
 };
 
 // load, compile, and link shaders, returning true if successful
@@ -84,16 +193,40 @@ bool InitializeShaders(MyShader *shader)
 
 	// link shader program
 	shader->program = LinkProgram(shader->vertex, shader->TCS, shader->TES, shader->fragment);
+
+	// record the tessellated lines when transform feedback is active, so
+	// static scenes can be replayed without tessellating again
+	const GLchar *varyings[] = { "gl_Position", "Colour" };
+	glTransformFeedbackVaryings(shader->program, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(shader->program);
+
 	shader->programNoTess = LinkProgram(shader->vertex, shader->fragment);
+
+	shader->curvesLocation = glGetUniformLocation(shader->program, "curves");
+	shader->offsetLocation = glGetUniformLocation(shader->program, "Offset");
+	shader->offsetLocationNoTess = glGetUniformLocation(shader->programNoTess, "Offset");
+	shader->variationLocation = glGetUniformLocation(shader->program, "Variation");
+	shader->variationLocationNoTess = glGetUniformLocation(shader->programNoTess, "Variation");
+
 	// check for OpenGL errors and return false if error occurred
 	return !CheckGLErrors();
 }
 
+// binds one of the shader's programs along with the current translation and
+// axis setting
+void SelectProgram(MyShader *shader, GLuint program)
+{
+	UseProgram(program);
+	bool tess = (program == shader->program);
+	Uniform2f(tess ? shader->offsetLocation : shader->offsetLocationNoTess, shader->offset[0], shader->offset[1]);
+	Uniform2f(tess ? shader->variationLocation : shader->variationLocationNoTess, shader->variation[0], shader->variation[1]);
+}
+
 // deallocate shader-related objects
 void DestroyShaders(MyShader *shader)
 {
 	// unbind any shader programs and destroy shader objects
-	glUseProgram(0);
+	UseProgram(0);
 	glDeleteProgram(shader->program);
 	glDeleteProgram(shader->programNoTess);
 	glDeleteShader(shader->vertex);
@@ -204,7 +337,7 @@ void GeneratePoint(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// create a vertex array object encapsulating all our vertex attributes
 	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
 
 	// associate the position array with the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
@@ -218,10 +351,7 @@ void GeneratePoint(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// unbind our buffers, resetting to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// check for OpenGL errors and return false if error occurred
-	CheckGLErrors();
+	BindVertexArray(0);
 }
 
 void Generateline(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates)[2], GLfloat (*colour)[3])
@@ -255,7 +385,7 @@ void Generateline(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates)
 
 	// create a vertex array object encapsulating all our vertex attributes
 	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
 
 	// associate the position array with the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
@@ -269,10 +399,7 @@ void Generateline(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates)
 
 	// unbind our buffers, resetting to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// check for OpenGL errors and return false if error occurred
-	CheckGLErrors();
+	BindVertexArray(0);
 }
 
 void GenerateQuadratic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates)[2], GLfloat (*colour)[3])
@@ -308,7 +435,7 @@ void GenerateQuadratic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordin
 
 	// create a vertex array object encapsulating all our vertex attributes
 	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
 
 	// associate the position array with the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
@@ -322,10 +449,7 @@ void GenerateQuadratic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordin
 
 	// unbind our buffers, resetting to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// check for OpenGL errors and return false if error occurred
-	CheckGLErrors();
+	BindVertexArray(0);
 }
 
 void GenerateCubic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates)[2], GLfloat (*colour)[3])
@@ -363,7 +487,7 @@ void GenerateCubic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// create a vertex array object encapsulating all our vertex attributes
 	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
 
 	// associate the position array with the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
@@ -377,10 +501,7 @@ void GenerateCubic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// unbind our buffers, resetting to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// check for OpenGL errors and return false if error occurred
-	CheckGLErrors();
+	BindVertexArray(0);
 }
 // create buffers and fill with geometry data, returning true if successful
 /*bool InitializeGeometry(MyGeometry *geometry)
@@ -416,7 +537,7 @@ void GenerateCubic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// create a vertex array object encapsulating all our vertex attributes
 	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
 
 	// associate the position array with the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
@@ -430,992 +551,1948 @@ void GenerateCubic(MyGeometry *geometry, MyShader *shader, GLfloat (*coordinates
 
 	// unbind our buffers, resetting to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	BindVertexArray(0);
 
 	// check for OpenGL errors and return false if error occurred
 	return !CheckGLErrors();
 }
 */
 
+// fills geometry with any number of vertices, given as packed xy positions
+// and rgb colours
+void GenerateGeometry(MyGeometry *geometry, const vector<GLfloat> &vertices, const vector<GLfloat> &colours)
+{
+	geometry->elementCount = vertices.size() / 2;
+	if (!geometry->elementCount) return;
+
+	const GLuint VERTEX_INDEX = 0;
+	const GLuint COLOUR_INDEX = 1;
+
+	glGenBuffers(1, &geometry->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &geometry->colourBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glBufferData(GL_ARRAY_BUFFER, colours.size() * sizeof(GLfloat), colours.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &geometry->vertexArray);
+	BindVertexArray(geometry->vertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
+
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(COLOUR_INDEX);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	BindVertexArray(0);
+}
+
 // deallocate geometry-related objects
 void DestroyGeometry(MyGeometry *geometry)
 {
 	// unbind and destroy our vertex array object and associated buffers
-	glBindVertexArray(0);
+	BindVertexArray(0);
 	glDeleteVertexArrays(1, &geometry->vertexArray);
 	glDeleteBuffers(1, &geometry->vertexBuffer);
 	glDeleteBuffers(1, &geometry->colourBuffer);
 }
 
 // --------------------------------------------------------------------------
-// Rendering function that draws our scene to the frame buffer
+// Functions to manage a heap of geometry inside one large buffer object
+//
+// Ranges are handed out first-fit from a free list that is kept sorted by
+// offset and coalesced on release. The heap only tracks free space; whoever
+// owns the allocated ranges is responsible for moving them when compacting.
 
-/*void RenderScene(MyGeometry *geometry, MyShader *shader)
+struct MyBufferHeap
 {
-	// clear screen to a dark grey colour
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	glUseProgram(shader->program);
-	glBindVertexArray(geometry->vertexArray);
-	glDrawArrays(GL_PATCHES, 0, geometry->elementCount);
-	glUseProgram(shader->programNoTess);
-	glDrawArrays(GL_LINE_STRIP, 0, geometry->elementCount);
-	glDrawArrays(GL_POINTS, 0, geometry->elementCount);
+	// OpenGL name of the backing buffer, and its size in bytes
+	GLuint     buffer;
+	GLsizeiptr capacity;
 
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glUseProgram(0);
+	// free ranges keyed by offset, and the number of bytes handed out
+	map<GLintptr, GLsizeiptr> freeBlocks;
+	GLsizeiptr used;
 
-	// check for an report any OpenGL errors
-	CheckGLErrors();
-}*/
+	MyBufferHeap() : buffer(0), capacity(0), used(0)
+	{}
+};
 
-void RenderBezier(MyGeometry *geometry, MyShader *shader)
+void InitializeHeap(MyBufferHeap *heap, GLsizeiptr capacity)
 {
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	glUseProgram(shader->program);
-	glBindVertexArray(geometry->vertexArray);
-	glDrawArrays(GL_PATCHES, 0, geometry->elementCount);
-
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glUseProgram(0);
-
-	// check for an report any OpenGL errors
-	CheckGLErrors();
+	heap->capacity = capacity;
+	heap->used = 0;
+	heap->freeBlocks.clear();
+	heap->freeBlocks[0] = capacity;
+
+	glGenBuffers(1, &heap->buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, heap->buffer);
+	glBufferData(GL_ARRAY_BUFFER, capacity, 0, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void RenderControlPoints(MyGeometry *geometry, MyShader *shader)
+// reserves a range of the given size, returning false if no free block fits
+bool HeapAllocate(MyBufferHeap *heap, GLsizeiptr size, GLintptr *offset)
 {
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	glUseProgram(shader->programNoTess);
-	glBindVertexArray(geometry->vertexArray);
-	glDrawArrays(GL_POINTS, 0, geometry->elementCount);
-
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glUseProgram(0);
-
-	// check for an report any OpenGL errors
-	CheckGLErrors();
+	map<GLintptr, GLsizeiptr>::iterator it;
+	for (it = heap->freeBlocks.begin(); it != heap->freeBlocks.end(); ++it)
+	{
+		if (it->second < size) continue;
+
+		*offset = it->first;
+		GLsizeiptr remaining = it->second - size;
+		heap->freeBlocks.erase(it);
+		if (remaining > 0)
+			heap->freeBlocks[*offset + size] = remaining;
+		heap->used += size;
+		return true;
+	}
+	return false;
 }
 
-void RenderControlLines(MyGeometry *geometry, MyShader *shader)
+// returns a range to the free list, merging it with adjacent free blocks
+void HeapFree(MyBufferHeap *heap, GLintptr offset, GLsizeiptr size)
 {
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	glUseProgram(shader->programNoTess);
-	glBindVertexArray(geometry->vertexArray);
-	glDrawArrays(GL_LINE_STRIP, 0, geometry->elementCount);
-
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glUseProgram(0);
+	heap->used -= size;
 
-	// check for an report any OpenGL errors
-	CheckGLErrors();
+	map<GLintptr, GLsizeiptr>::iterator next = heap->freeBlocks.lower_bound(offset);
+	if (next != heap->freeBlocks.end() && offset + size == next->first) {
+		size += next->second;
+		heap->freeBlocks.erase(next++);
+	}
+	if (next != heap->freeBlocks.begin()) {
+		map<GLintptr, GLsizeiptr>::iterator prev = next;
+		--prev;
+		if (prev->first + prev->second == offset) {
+			prev->second += size;
+			return;
+		}
+	}
+	heap->freeBlocks[offset] = size;
 }
 
-void ClearScene(MyGeometry *geometry, MyShader *shader)
+void DestroyHeap(MyBufferHeap *heap)
 {
-    // clear screen to a dark grey colour
-    glClearColor(0.2, 0.2, 0.2, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    CheckGLErrors();
+	glDeleteBuffers(1, &heap->buffer);
+	heap->buffer = 0;
+	heap->freeBlocks.clear();
+	heap->capacity = heap->used = 0;
 }
 
 // --------------------------------------------------------------------------
-// GLFW callback functions
+// Functions to stage uploads through fenced, triple-buffered regions
+//
+// No patch data is built per frame: every level is baked once, and glyphs are
+// extracted and packed on the loader's worker threads. What is left for the
+// render loop to upload is the glyphs it makes resident while baking text
+// levels, and those go through here. Up to three frames may be in flight at
+// once. Each has its own region of a staging buffer, which is written through
+// an unsynchronized mapping once the fence of the frame that last used the
+// region has passed, and then copied into place on the GPU, so uploads never
+// wait for draws that are still reading their destination.
+
+const int FRAMES_IN_FLIGHT = 3;
+
+struct MyFramePipeline
+{
+	// staging buffer holding one region per frame in flight
+	GLuint     staging;
+	GLsizeiptr regionSize;
+	GLsizeiptr regionUsed;
+	int        slot;
+
+	// fence and GPU timer of the frame that last used each region
+	GLsync     fences[FRAMES_IN_FLIGHT];
+	GLuint     timers[FRAMES_IN_FLIGHT];
+	bool       timing[FRAMES_IN_FLIGHT];
+
+	// statistics since the last report
+	unsigned int gpuFrames;
+	double       gpuTotal;
+	unsigned int stalls;
+	unsigned int overflows;
+
+	MyFramePipeline() : staging(0), regionSize(0), regionUsed(0), slot(0),
+		gpuFrames(0), gpuTotal(0), stalls(0), overflows(0)
+	{
+		for (int i = 0; i < FRAMES_IN_FLIGHT; i++) { fences[i] = 0; timers[i] = 0; timing[i] = false; }
+	}
+};
 
-// reports GLFW errors
-void ErrorCallback(int error, const char* description)
+void InitializeFramePipeline(MyFramePipeline *pipeline, GLsizeiptr regionSize)
 {
-	cout << "GLFW ERROR " << error << ":" << endl;
-	cout << description << endl;
+	pipeline->regionSize = regionSize;
+	glGenBuffers(1, &pipeline->staging);
+	glBindBuffer(GL_COPY_READ_BUFFER, pipeline->staging);
+	glBufferData(GL_COPY_READ_BUFFER, regionSize * FRAMES_IN_FLIGHT, 0, GL_STREAM_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glGenQueries(FRAMES_IN_FLIGHT, pipeline->timers);
 }
 
-// handles keyboard input events
-void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+// moves on to the next region, first waiting for the GPU to finish the frame
+// that used it last
+void BeginPipelinedFrame(MyFramePipeline *pipeline)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GL_TRUE);
+	pipeline->slot = (pipeline->slot + 1) % FRAMES_IN_FLIGHT;
+	int slot = pipeline->slot;
+
+	if (pipeline->fences[slot]) {
+		if (glClientWaitSync(pipeline->fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+			pipeline->stalls++;
+			while (glClientWaitSync(pipeline->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+				;
+		}
+		glDeleteSync(pipeline->fences[slot]);
+		pipeline->fences[slot] = 0;
+	}
 
-    if (action == GLFW_PRESS)
-    {
-      switch (key)
-      {
-        case GLFW_KEY_RIGHT :
-        if (level < 8)
-          level++;
-				else
-					level = 1;
-        break;
-        case GLFW_KEY_LEFT :
-        if (level > 1)
-          level--;
-				else
-					level = 8;
-        break;
-				case GLFW_KEY_UP :
-        	rate = rate + 0.01;
-        break;
-				case GLFW_KEY_DOWN :
-        	rate = rate - 0.01;
-        break;
-      }
-    }
+	// the fence has passed, so the frame's timer result is ready
+	if (pipeline->timing[slot]) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(pipeline->timers[slot], GL_QUERY_RESULT, &elapsed);
+		pipeline->gpuTotal += elapsed * 1e-9;
+		pipeline->gpuFrames++;
+		pipeline->timing[slot] = false;
+	}
+
+	pipeline->regionUsed = 0;
 }
 
-// ==========================================================================
-// PROGRAM ENTRY POINT
+// measures the GPU time of the rest of this frame
+void BeginFrameTimer(MyFramePipeline *pipeline)
+{
+	glBeginQuery(GL_TIME_ELAPSED, pipeline->timers[pipeline->slot]);
+	pipeline->timing[pipeline->slot] = true;
+}
 
-int main(int argc, char *argv[])
+// copies data into a buffer through this frame's staging region, returning
+// false (and doing nothing) if the region is full
+bool StageUpload(MyFramePipeline *pipeline, GLuint buffer, GLintptr offset, const void *data, GLsizeiptr size)
 {
-	// initialize the GLFW windowing system
-	if (!glfwInit()) {
-		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
-		return -1;
+	if (size > pipeline->regionSize - pipeline->regionUsed) {
+		pipeline->overflows++;
+		return false;
 	}
-	glfwSetErrorCallback(ErrorCallback);
 
-	// attempt to create a window with an OpenGL 4.1 core profile context
-	GLFWwindow *window = 0;
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	window = glfwCreateWindow(1920, 1080, "CPSC 453 Assignment #3", 0, 0);
-	if (!window) {
-		cout << "Program failed to create GLFW window, TERMINATING" << endl;
-		glfwTerminate();
-		return -1;
+	GLintptr source = pipeline->slot * pipeline->regionSize + pipeline->regionUsed;
+	glBindBuffer(GL_COPY_READ_BUFFER, pipeline->staging);
+	void *mapped = glMapBufferRange(GL_COPY_READ_BUFFER, source, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!mapped) {
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		return false;
 	}
+	memcpy(mapped, data, size);
+	glUnmapBuffer(GL_COPY_READ_BUFFER);
 
-	// set keyboard callback function and make our context current (active)
-	glfwSetKeyCallback(window, KeyCallback);
-	glfwMakeContextCurrent(window);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, offset, size);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
 
-	// query and print out information about our OpenGL environment
-	QueryGLVersion();
+	// keep later copies aligned for the mapping
+	pipeline->regionUsed += (size + 15) & ~GLsizeiptr(15);
+	return true;
+}
 
-	// call function to load and compile shader programs
-	MyShader shader;
-	if (!InitializeShaders(&shader)) {
-		cout << "Program could not initialize shaders, TERMINATING" << endl;
-		return -1;
-	}
+// fences off everything issued for this frame
+void EndPipelinedFrame(MyFramePipeline *pipeline)
+{
+	int slot = pipeline->slot;
+	if (pipeline->timing[slot])
+		glEndQuery(GL_TIME_ELAPSED);
+	pipeline->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-	// call function to create and fill buffers with geometry data
-	MyGeometry geometry;
-//	if (!InitializeGeometry(&geometry))
-//		cout << "Program failed to intialize geometry!" << endl;
+void DestroyFramePipeline(MyFramePipeline *pipeline)
+{
+	for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+		if (pipeline->fences[i]) glDeleteSync(pipeline->fences[i]);
+	glDeleteQueries(FRAMES_IN_FLIGHT, pipeline->timers);
+	glDeleteBuffers(1, &pipeline->staging);
+}
 
-	glPointSize(5);
+// --------------------------------------------------------------------------
+// Functions to set up instanced glyph geometry
+//
+// Each unique (font, glyph, size) is extracted and packed once, normally by
+// the loader thread, and sub-allocated from a glyph heap shared by all fonts.
+// A glyph's block holds its packed control points followed by its index lists
+// (see MyPackedGlyph). Text is then drawn as instances of these resident meshes, each with its own
+// offset, scale and colour. When the heap's byte budget runs out the least
+// recently drawn glyphs are evicted, and the heap is compacted when free space
+// is too fragmented to satisfy an allocation.
+//
+// Glyphs of variable fonts also have the offsets of their control points at
+// either end of each axis, kept in a delta buffer that parallels the heap: the
+// deltas of the vertex at heap offset o sit at DeltaOffset(o), so that the same
+// base vertex reads both. The vertex shader blends them by the current axis
+// setting, so animating the axes never touches the glyphs themselves.
+//
+// Composite glyphs, such as accented letters, have no block of their own; they
+// are laid out as instances of their components, which are only resident once
+// however many composites use them. Glyphs go by glyph index, so a component
+// that is also a letter of the text is the same resident glyph as that
+// letter.
+//
+// The packed glyphs behind the heap are kept on the CPU too, within a byte
+// budget of their own, so that evicted glyphs can come back without extracting
+// them again. Past the budget the least recently used are dropped, except for
+// those used in the current frame; a dropped glyph is extracted again on this
+// thread if it is ever needed. The budget covers every outline kept on the CPU,
+// as the extractors keep none of their own.
+
+struct MyGlyphMesh
+{
+	// byte range of the glyph's block within the glyph heap
+	GLintptr   offset;
+	GLsizeiptr size;
 
-	GLint loc1 = glGetUniformLocation(shader.program, "curves");
-	GLint loc2 = glGetUniformLocation(shader.programNoTess, "curves");
+	// start of the index lists, in bytes from the start of the block
+	GLsizeiptr indexStart;
 
-	GLfloat vertices[4][2];
-	GLfloat colours[4][3];
-	float scale = 10.0f;
+	// first index and number of indices of the segments of each degree
+	GLint   first[4];
+	GLsizei count[4];
 
-	float move = 1.0;
-	bool end = false;
-	bool g = false;
+	// advance width to next glyph, in EM units
+	float   advance;
 
-	//Load a font file and extract a glyph
-	GlyphExtractor extractor;
+	// frame in which this glyph was last drawn, for LRU eviction
+	unsigned int lastUsed;
 
-	// run an event-triggered main loop
-	while (!glfwWindowShouldClose(window))
-	{
+	// true if the glyph has deltas in the delta buffer
+	bool    variable;
 
-		ClearScene(&geometry, &shader);
+	// components a composite glyph is drawn as
+	vector<MyGlyphComponent> components;
 
-		switch (level)
-		{
-			case 1 :
-			case 2 :
-
-			glUseProgram(shader.program);
-			glUniform2f(loc1, 0.0, 0.0);
-			glUseProgram(shader.programNoTess);
-			glUniform2f(loc2, 0.0, 0.0);
-
-			glPatchParameteri(GL_PATCH_VERTICES, 3);
-
-		vertices[0][0] = 1.0/scale; vertices[0][1] = 1.0/scale;
-		vertices[1][0] = 2.0/scale;  vertices[1][1] = -1.0/scale;
-		vertices[2][0] = 0.0/scale;  vertices[2][1] = -1.0/scale;
-
-		if(level == 2){
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlLines(&geometry, &shader);
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlPoints(&geometry, &shader);
-		}
+	MyGlyphMesh() : offset(0), size(0), indexStart(0), advance(0), lastUsed(0), variable(false)
+	{
+		for (int d = 0; d < 4; d++) { first[d] = 0; count[d] = 0; }
+	}
+};
 
-		for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-		colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-		GenerateQuadratic(&geometry, &shader, vertices, colours);
-		RenderBezier(&geometry, &shader);
-
-		vertices[0][0] = 0.0/scale; vertices[0][1] = -1.0/scale;
-		vertices[1][0] = -2.0/scale;  vertices[1][1] = -1.0/scale;
-		vertices[2][0] = -1.0/scale;  vertices[2][1] = 1.0/scale;
-
-		if(level == 2){
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlLines(&geometry, &shader);
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlPoints(&geometry, &shader);
-		}
+// a glyph control point: EM-box coordinates in 16-bit fixed point, so that a
+// vertex takes four bytes; colour comes from the instance instead
+struct MyGlyphVertex
+{
+	GLshort x, y;
+};
+
+// per-instance attributes, laid out as read by the vertex shader
+struct MyGlyphInstance
+{
+	// xy offset, w scale applied to the glyph's fixed point coordinates (z unused)
+	GLfloat transform[4];
+	GLfloat colour[3];
+};
+
+// a line of text in one font and colour, placed in normalized device
+// coordinates, with its glyphs hinted at ppem pixels per EM (zero for their
+// design outlines)
+struct MyTextRun
+{
+	string  font;
+	string  text;
+	GLfloat x, y;
+	GLfloat scale;
+	GLfloat colour[3];
+	int     ppem;
+};
+
+// identifies a glyph: the font file, glyph index and size it was extracted at
+struct MyGlyphKey
+{
+	string font;
+	uint   index;
+	int    ppem;
+
+	MyGlyphKey(const string &f, uint i, int p) : font(f), index(i), ppem(p)
+	{}
+
+	bool operator<(const MyGlyphKey &other) const
+	{
+		if (index != other.index) return index < other.index;
+		if (ppem != other.ppem) return ppem < other.ppem;
+		return font < other.font;
+	}
+};
+
+// a packed glyph kept on the CPU, with its size and when it was last used
+struct MyStoredGlyph
+{
+	MyPackedGlyph glyph;
+	size_t        bytes;
+	unsigned int  lastUsed;
+
+	MyStoredGlyph() : bytes(0), lastUsed(0)
+	{}
+};
+
+struct MyGlyphCache
+{
+	// extractor and the font file currently loaded into it
+	GlyphExtractor extractor;
+	string         fontFile;
+
+	// resident glyphs, keyed by font file, glyph index and size
+	map<MyGlyphKey, MyGlyphMesh> meshes;
+
+	// packed glyphs handed over by the loader thread, kept so that evicted
+	// glyphs can be uploaded again without reopening their font, and the
+	// bytes they may take up
+	map<MyGlyphKey, MyStoredGlyph> packed;
+	size_t packedBudget;
+	size_t packedBytes;
+
+	// how each font's characters are drawn, and its kerning pairs, for laying
+	// out text without its outlines
+	map<string, MyLoadedFont> fonts;
+
+	// control points and indices of all resident glyphs, and the vertex array
+	// reading them
+	MyBufferHeap heap;
+	GLuint       vertexArray;
+
+	// variation deltas paralleling the heap, created with the first variable
+	// glyph
+	GLuint       deltaBuffer;
+
+	// current frame number; glyphs drawn in it are pinned against eviction
+	unsigned int frame;
+
+	// uploads go through the frame pipeline's staging ring when there is one
+	MyFramePipeline *pipeline;
+
+	// running totals, for reporting
+	unsigned int uploads;
+	unsigned int evictions;
+	unsigned int compactions;
+	unsigned int packedEvictions;
+	unsigned int extractions;
+
+	MyGlyphCache() : packedBudget(0), packedBytes(0), vertexArray(0), deltaBuffer(0), frame(1), pipeline(0),
+		uploads(0), evictions(0), compactions(0), packedEvictions(0), extractions(0)
+	{}
+};
+
+// bytes per glyph control point in the heap; blocks are sized in multiples of
+// this so that every block starts on a vertex boundary
+const GLsizeiptr GLYPH_VERTEX_SIZE = sizeof(MyGlyphVertex);
+
+// bytes of variation deltas per control point
+const GLsizeiptr GLYPH_DELTA_SIZE = GLYPH_DELTA_COMPONENTS * sizeof(GLshort);
+
+// position in the delta buffer of the deltas of the vertex at a heap offset
+GLintptr DeltaOffset(GLintptr offset)
+{
+	return offset / GLYPH_VERTEX_SIZE * GLYPH_DELTA_SIZE;
+}
+
+// points the delta attributes of the glyph vertex array at the delta buffer:
+// the offsets at the maximum and minimum of each axis, as separate streams
+void BindGlyphDeltas(MyGlyphCache *cache)
+{
+	const GLuint DELTA_INDEX = 3;
+
+	BindVertexArray(cache->vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, cache->deltaBuffer);
+	GLubyte *offset = 0;
+	for (int s = 0; s < GLYPH_DELTA_COMPONENTS / 2; s++)
+		glVertexAttribPointer(DELTA_INDEX + s, 2, GL_SHORT, GL_FALSE, GLYPH_DELTA_SIZE, offset + s * sizeof(GLshort[2]));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	BindVertexArray(0);
+}
+
+// enables the delta attributes for drawing a variable glyph; static glyphs
+// leave them disabled, so they read zero rather than stale deltas
+void EnableGlyphDeltas(bool enable)
+{
+	const GLuint DELTA_INDEX = 3;
+	for (int s = 0; s < GLYPH_DELTA_COMPONENTS / 2; s++) {
+		if (enable) glEnableVertexAttribArray(DELTA_INDEX + s);
+		else glDisableVertexAttribArray(DELTA_INDEX + s);
+	}
+}
+
+// creates the glyph heap with the given byte budget, and sets the budget of
+// packed glyphs kept on the CPU
+void InitializeGlyphCache(MyGlyphCache *cache, GLsizeiptr budget, size_t packedBudget)
+{
+	// these vertex attribute indices correspond to those specified for the
+	// input variables in the vertex shader
+	const GLuint VERTEX_INDEX = 0;
+
+	InitializeHeap(&cache->heap, budget);
+	cache->packedBudget = packedBudget;
+
+	// create a vertex array object reading control points and indices from the
+	// heap; the per-instance attributes are pointed at the instance buffer at
+	// draw time
+	glGenVertexArrays(1, &cache->vertexArray);
+	BindVertexArray(cache->vertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, cache->heap.buffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_SHORT, GL_FALSE, sizeof(MyGlyphVertex), 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cache->heap.buffer);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	BindVertexArray(0);
+
+	CheckGLErrors();
+}
+
+// moves all resident glyphs to the front of a fresh buffer, leaving a single
+// free block at the end of the heap
+void CompactGlyphHeap(MyGlyphCache *cache)
+{
+	const GLuint VERTEX_INDEX = 0;
+	MyBufferHeap *heap = &cache->heap;
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, heap->capacity, 0, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, heap->buffer);
+
+	GLintptr packed = 0;
+	vector<GLintptr> moved;
+	map<MyGlyphKey, MyGlyphMesh>::iterator it;
+	for (it = cache->meshes.begin(); it != cache->meshes.end(); ++it)
+	{
+		MyGlyphMesh &mesh = it->second;
+		moved.push_back(mesh.offset);
+		if (mesh.size > 0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mesh.offset, packed, mesh.size);
+		mesh.offset = packed;
+		packed += mesh.size;
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &heap->buffer);
+	heap->buffer = buffer;
+
+	heap->freeBlocks.clear();
+	if (packed < heap->capacity)
+		heap->freeBlocks[packed] = heap->capacity - packed;
+
+	// move the deltas of variable glyphs along with them
+	if (cache->deltaBuffer)
+	{
+		GLuint deltas;
+		glGenBuffers(1, &deltas);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, deltas);
+		glBufferData(GL_COPY_WRITE_BUFFER, DeltaOffset(heap->capacity), 0, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, cache->deltaBuffer);
+		uint m = 0;
+		for (it = cache->meshes.begin(); it != cache->meshes.end(); ++it, ++m)
+		{
+			MyGlyphMesh &mesh = it->second;
+			if (mesh.variable)
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, DeltaOffset(moved[m]),
+					DeltaOffset(mesh.offset), DeltaOffset(mesh.indexStart));
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &cache->deltaBuffer);
+		cache->deltaBuffer = deltas;
+		BindGlyphDeltas(cache);
+	}
+
+	// repoint the vertex array at the new buffer
+	BindVertexArray(cache->vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, heap->buffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_SHORT, GL_FALSE, sizeof(MyGlyphVertex), 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, heap->buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	BindVertexArray(0);
+
+	cache->compactions++;
+}
+
+// finds room for size bytes in the glyph heap, evicting least recently drawn
+// glyphs and compacting as needed; returns false if the glyphs pinned by the
+// current frame leave no room
+bool AllocateGlyph(MyGlyphCache *cache, GLsizeiptr size, GLintptr *offset)
+{
+	MyBufferHeap *heap = &cache->heap;
+	while (heap->capacity - heap->used < size)
+	{
+		map<MyGlyphKey, MyGlyphMesh>::iterator victim = cache->meshes.end();
+		map<MyGlyphKey, MyGlyphMesh>::iterator it;
+		for (it = cache->meshes.begin(); it != cache->meshes.end(); ++it) {
+			if (it->second.lastUsed == cache->frame || it->second.size == 0) continue;
+			if (victim == cache->meshes.end() || it->second.lastUsed < victim->second.lastUsed)
+				victim = it;
+		}
+		if (victim == cache->meshes.end())
+			return false;
+
+		HeapFree(heap, victim->second.offset, victim->second.size);
+		cache->meshes.erase(victim);
+		cache->evictions++;
+	}
+
+	if (HeapAllocate(heap, size, offset))
+		return true;
+
+	// enough bytes are free, just not in one piece
+	CompactGlyphHeap(cache);
+	return HeapAllocate(heap, size, offset);
+}
+
+// copies a packed glyph into a block of the glyph heap; returns false if the
+// heap has no room for it this frame
+bool UploadGlyph(MyGlyphCache *cache, MyGlyphMesh *mesh, const MyPackedGlyph &glyph)
+{
+	mesh->advance = glyph.advance;
+	mesh->components = glyph.components;
+	for (int d = 0; d < 4; d++) {
+		mesh->first[d] = glyph.first[d];
+		mesh->count[d] = glyph.count[d];
+	}
+
+	GLsizeiptr vertexBytes = glyph.points.size() * sizeof(GLshort);
+	GLsizeiptr indexBytes = glyph.indices.size() * sizeof(GLushort);
+	GLsizeiptr size = vertexBytes + indexBytes;
+	size = (size + GLYPH_VERTEX_SIZE - 1) / GLYPH_VERTEX_SIZE * GLYPH_VERTEX_SIZE;
+	if (vertexBytes == 0)
+		return true;
+
+	if (!AllocateGlyph(cache, size, &mesh->offset)) {
+		cout << "Glyph heap ERROR: no room for " << size << " bytes" << endl;
+		return false;
+	}
+	mesh->size = size;
+	mesh->indexStart = vertexBytes;
+	mesh->variable = !glyph.deltas.empty();
+
+	// copy the control points and indices into the glyph's block of the heap,
+	// staged so as not to wait on draws still reading the heap
+	MyFramePipeline *pipeline = cache->pipeline;
+	if (!pipeline || !StageUpload(pipeline, cache->heap.buffer, mesh->offset, glyph.points.data(), vertexBytes)
+		|| !StageUpload(pipeline, cache->heap.buffer, mesh->offset + vertexBytes, glyph.indices.data(), indexBytes))
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, cache->heap.buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, mesh->offset, vertexBytes, glyph.points.data());
+		glBufferSubData(GL_ARRAY_BUFFER, mesh->offset + vertexBytes, indexBytes, glyph.indices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// and the deltas of a variable glyph into the matching part of the delta
+	// buffer, creating it for the first such glyph
+	if (mesh->variable)
+	{
+		GLsizeiptr deltaBytes = glyph.deltas.size() * sizeof(GLshort);
+		if (!cache->deltaBuffer) {
+			glGenBuffers(1, &cache->deltaBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, cache->deltaBuffer);
+			glBufferData(GL_ARRAY_BUFFER, DeltaOffset(cache->heap.capacity), 0, GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			BindGlyphDeltas(cache);
+		}
+		if (!pipeline || !StageUpload(pipeline, cache->deltaBuffer, DeltaOffset(mesh->offset), glyph.deltas.data(), deltaBytes)) {
+			glBindBuffer(GL_ARRAY_BUFFER, cache->deltaBuffer);
+			glBufferSubData(GL_ARRAY_BUFFER, DeltaOffset(mesh->offset), deltaBytes, glyph.deltas.data());
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+	cache->uploads++;
+
+	return true;
+}
+
+// bytes a packed glyph takes up on the CPU, counting its map entry
+size_t PackedGlyphBytes(const MyGlyphKey &key, const MyPackedGlyph &glyph)
+{
+	return sizeof(MyGlyphKey) + sizeof(MyStoredGlyph) + key.font.capacity()
+		+ glyph.points.capacity() * sizeof(short)
+		+ glyph.deltas.capacity() * sizeof(short)
+		+ glyph.indices.capacity() * sizeof(unsigned short)
+		+ glyph.components.capacity() * sizeof(MyGlyphComponent);
+}
+
+// drops least recently used packed glyphs until they fit the budget again;
+// glyphs used in the current frame are kept even if that leaves it exceeded
+void TrimPackedGlyphs(MyGlyphCache *cache)
+{
+	if (cache->packedBytes <= cache->packedBudget) return;
+
+	// order the unpinned glyphs from least to most recently used in one pass,
+	// as a large font may have thousands to drop at once
+	typedef map<MyGlyphKey, MyStoredGlyph>::iterator StoredIterator;
+	vector<pair<unsigned int, StoredIterator> > victims;
+	for (StoredIterator it = cache->packed.begin(); it != cache->packed.end(); ++it)
+		if (it->second.lastUsed != cache->frame)
+			victims.push_back(make_pair(it->second.lastUsed, it));
+	sort(victims.begin(), victims.end(), [](const pair<unsigned int, StoredIterator> &a,
+		const pair<unsigned int, StoredIterator> &b) { return a.first < b.first; });
+
+	for (uint v = 0; v < victims.size() && cache->packedBytes > cache->packedBudget; v++) {
+		cache->packedBytes -= victims[v].second->second.bytes;
+		cache->packed.erase(victims[v].second);
+		cache->packedEvictions++;
+	}
+}
+
+// keeps a packed glyph on the CPU, as used in the current frame
+MyPackedGlyph &StorePackedGlyph(MyGlyphCache *cache, const MyGlyphKey &key, MyPackedGlyph &glyph)
+{
+	MyStoredGlyph &stored = cache->packed[key];
+	cache->packedBytes -= stored.bytes;
+	stored.glyph = std::move(glyph);
+	stored.bytes = PackedGlyphBytes(key, stored.glyph);
+	stored.lastUsed = cache->frame;
+	cache->packedBytes += stored.bytes;
+	return stored.glyph;
+}
+
+// prints what the glyph heap and the packed glyphs behind it hold
+void ReportGlyphCache(MyGlyphCache *cache)
+{
+	cout << "Glyph heap: " << cache->meshes.size() << " glyphs, " << cache->heap.used << " of "
+		<< cache->heap.capacity << " bytes, " << cache->uploads << " uploads, " << cache->evictions
+		<< " evictions, " << cache->compactions << " compactions" << endl;
+	cout << "Packed glyphs: " << cache->packed.size() << " glyphs, " << cache->packedBytes << " of "
+		<< cache->packedBudget << " bytes, " << cache->packedEvictions << " evictions, "
+		<< cache->extractions << " extracted on this thread" << endl;
+}
+
+// forgets a glyph whose upload failed, so that it is uploaded again the next
+// time it is fetched, and gives an empty mesh to draw in the meantime
+const MyGlyphMesh &DropGlyph(MyGlyphCache *cache, const MyGlyphKey &key)
+{
+	static const MyGlyphMesh empty;
+	cache->meshes.erase(key);
+	return empty;
+}
+
+// returns the mesh for a glyph, by index, extracting and uploading it on first
+// use; a nonzero ppem gives the glyph hinted for that many pixels per EM
+const MyGlyphMesh &FetchGlyph(MyGlyphCache *cache, const string &font, uint index, int ppem = 0)
+{
+	MyGlyphKey key(font, index, ppem);
+	map<MyGlyphKey, MyStoredGlyph>::iterator packed = cache->packed.find(key);
+	if (packed != cache->packed.end())
+		packed->second.lastUsed = cache->frame;
+
+	map<MyGlyphKey, MyGlyphMesh>::iterator it = cache->meshes.find(key);
+	if (it != cache->meshes.end()) {
+		it->second.lastUsed = cache->frame;
+		return it->second;
+	}
+
+	// pin the new glyph before allocating, so it cannot evict itself
+	MyGlyphMesh &mesh = cache->meshes[key];
+	mesh.lastUsed = cache->frame;
+
+	// prefer a glyph the loader already packed
+	if (packed != cache->packed.end()) {
+		if (!UploadGlyph(cache, &mesh, packed->second.glyph))
+			return DropGlyph(cache, key);
+		return mesh;
+	}
+
+	// only reopen the font when a glyph from it is actually missing; the
+	// extractor keeps no outlines of its own, so a glyph dropped from the
+	// packed store is really extracted again
+	if (cache->fontFile != font) {
+		cache->extractor.LoadFontFile(font);
+		cache->fontFile = font;
+	}
+	MyPackedGlyph extracted;
+	ExtractPackedGlyph(cache->extractor, index, ppem, extracted);
+	cache->extractions++;
+	bool uploaded = UploadGlyph(cache, &mesh, StorePackedGlyph(cache, key, extracted));
+	TrimPackedGlyphs(cache);
+	if (!uploaded)
+		return DropGlyph(cache, key);
+	return mesh;
+}
+
+// composites nested deeper than this are not drawn, guarding against fonts
+// whose composites refer to themselves
+const int MAX_COMPONENT_DEPTH = 8;
+
+// true if a glyph, and the components of a composite, can be fetched without
+// extracting them on this thread
+bool GlyphAvailable(MyGlyphCache *cache, const string &font, uint index, int ppem = 0, int depth = 0)
+{
+	MyGlyphKey key(font, index, ppem);
+	const vector<MyGlyphComponent> *components;
+	map<MyGlyphKey, MyGlyphMesh>::iterator mesh = cache->meshes.find(key);
+	map<MyGlyphKey, MyStoredGlyph>::iterator packed = cache->packed.find(key);
+	if (mesh != cache->meshes.end())
+		components = &mesh->second.components;
+	else if (packed != cache->packed.end())
+		components = &packed->second.glyph.components;
+	else
+		return false;
+
+	for (uint c = 0; c < components->size() && depth < MAX_COMPONENT_DEPTH; c++)
+		if (!GlyphAvailable(cache, font, (*components)[c].index, ppem, depth + 1))
+			return false;
+	return true;
+}
+
+// collects the glyphs packed by the loader thread since the last call,
+// returning the number received
+int ReceiveGlyphs(MyGlyphCache *cache, GlyphLoader *loader)
+{
+	int received = 0;
+	MyLoadedFont font;
+	while (loader->PollFont(font))
+		cache->fonts[font.font] = std::move(font);
+
+	MyLoadedGlyph loaded;
+	while (loader->Poll(loaded)) {
+		MyGlyphKey key(loaded.font, loaded.index, loaded.ppem);
+		StorePackedGlyph(cache, key, loaded.glyph);
+		received++;
+	}
+	TrimPackedGlyphs(cache);
+	return received;
+}
+
+// the font, glyph index and advance that a character of text set in the given
+// font is drawn with, as the loader resolved it through the fallback chain;
+// null until the loader has delivered the font
+const MyFallbackGlyph *ResolveGlyph(MyGlyphCache *cache, const string &font, char character)
+{
+	map<string, MyLoadedFont>::iterator table = cache->fonts.find(font);
+	if (table == cache->fonts.end())
+		return 0;
+	return &table->second.glyphs[(unsigned char)character];
+}
+
+// kerning between two glyphs of one font, by index, in EM units, from the
+// font's flattened pair table; zero until the loader has delivered it
+float GlyphKerning(MyGlyphCache *cache, const string &font, uint left, uint right)
+{
+	map<string, MyLoadedFont>::iterator table = cache->fonts.find(font);
+	if (table == cache->fonts.end())
+		return 0;
+	return table->second.kerning.Lookup(left, right);
+}
+
+// advance width of a whole run, in EM units, each character taken from the
+// font that draws it and kerned against the one before it in the same font
+float TextAdvance(MyGlyphCache *cache, const string &font, const string &text)
+{
+	float advance = 0;
+	const MyFallbackGlyph *previous = 0;
+	for (uint i = 0; i < text.size(); i++) {
+		const MyFallbackGlyph *glyph = ResolveGlyph(cache, font, text[i]);
+		if (!glyph) continue;
+		if (previous && previous->font == glyph->font)
+			advance += GlyphKerning(cache, glyph->font, previous->index, glyph->index);
+		advance += glyph->advance;
+		previous = glyph;
+	}
+	return advance;
+}
+
+// deallocate glyph-related objects
+void DestroyGlyphCache(MyGlyphCache *cache)
+{
+	BindVertexArray(0);
+	glDeleteVertexArrays(1, &cache->vertexArray);
+	DestroyHeap(&cache->heap);
+	glDeleteBuffers(1, &cache->deltaBuffer);
+	cache->meshes.clear();
+	cache->packed.clear();
+	cache->packedBytes = 0;
+}
+
+// --------------------------------------------------------------------------
+// Functions to record tessellated curves with transform feedback
+//
+// The curves of the static levels never change, so rather than running them
+// through the tessellation stages every frame, the lines coming out of the
+// tessellation evaluation shader are captured once and replayed as plain
+// line segments until the level or the framebuffer size changes.
+
+struct MyCurveCapture
+{
+	// OpenGL names for the feedback object, the buffer it writes to, and the
+	// vertex array replaying that buffer
+	GLuint     feedback;
+	GLuint     buffer;
+	GLuint     vertexArray;
+	GLsizeiptr capacity;
+
+	// query counting the lines written, to detect a full buffer
+	GLuint     writtenQuery;
+
+	// level and framebuffer size of the captured scene (level 0 if none)
+	int level;
+	int width, height;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyCurveCapture() : feedback(0), buffer(0), vertexArray(0), capacity(0),
+		writtenQuery(0), level(0), width(0), height(0)
+	{}
+};
+
+// one captured vertex: gl_Position and Colour as written by the evaluation shader
+struct MyCapturedVertex
+{
+	GLfloat position[4];
+	GLfloat colour[3];
+};
+
+// set while a capture is in progress; transform feedback then stays paused
+// except around tessellated draws
+static bool capturingCurves = false;
+
+// (re)allocates the capture buffer and attaches it to the feedback object
+void ResizeCurveCapture(MyCurveCapture *capture, GLsizeiptr capacity)
+{
+	capture->capacity = capacity;
+	glBindBuffer(GL_ARRAY_BUFFER, capture->buffer);
+	glBufferData(GL_ARRAY_BUFFER, capacity, 0, GL_STATIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, capture->feedback);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capture->buffer);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+}
+
+void InitializeCurveCapture(MyCurveCapture *capture, GLsizeiptr capacity)
+{
+	// these vertex attribute indices correspond to those specified for the
+	// input variables in the vertex shader
+	const GLuint VERTEX_INDEX = 0;
+	const GLuint COLOUR_INDEX = 1;
+
+	glGenTransformFeedbacks(1, &capture->feedback);
+	glGenBuffers(1, &capture->buffer);
+	glGenQueries(1, &capture->writtenQuery);
+	ResizeCurveCapture(capture, capacity);
+
+	// replay reads the xy of each captured position and its colour
+	glGenVertexArrays(1, &capture->vertexArray);
+	BindVertexArray(capture->vertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, capture->buffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_FLOAT, GL_FALSE, sizeof(MyCapturedVertex), 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
+	glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(MyCapturedVertex), (void *)sizeof(GLfloat[4]));
+	glEnableVertexAttribArray(COLOUR_INDEX);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	BindVertexArray(0);
+
+	CheckGLErrors();
+}
+
+// true if the captured lines can stand in for the given scene
+bool CurveCaptureCurrent(const MyCurveCapture *capture, int level, int width, int height)
+{
+	return capture->level == level && capture->width == width && capture->height == height;
+}
+
+// starts recording; the scene is then drawn as usual
+void BeginCurveCapture(MyCurveCapture *capture, MyShader *shader, int level, int width, int height)
+{
+	capture->level = level;
+	capture->width = width;
+	capture->height = height;
+
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, capture->feedback);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, capture->writtenQuery);
+
+	// recording must begin with the tessellation program bound, and stays
+	// paused so that the scene may switch programs in between curve draws
+	SelectProgram(shader, shader->program);
+	glBeginTransformFeedback(GL_LINES);
+	glPauseTransformFeedback();
+	capturingCurves = true;
+}
+
+void EndCurveCapture(MyCurveCapture *capture)
+{
+	capturingCurves = false;
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+	// this waits for the capture to finish, but only happens once per scene
+	GLuint written;
+	glGetQueryObjectuiv(capture->writtenQuery, GL_QUERY_RESULT, &written);
+
+	// feedback stops at the last whole line that fits, which seldom ends the
+	// buffer exactly, so it is full once no further line would fit
+	const GLsizeiptr LINE_BYTES = 2 * sizeof(MyCapturedVertex);
+	if (GLsizeiptr(written) >= capture->capacity / LINE_BYTES) {
+		// the buffer filled up, so lines may have been dropped: grow it and
+		// capture again next frame
+		ResizeCurveCapture(capture, 2 * capture->capacity);
+		capture->level = 0;
+	}
+}
+
+// draws the captured lines in place of the tessellated curves
+void ReplayCurves(MyCurveCapture *capture, MyShader *shader)
+{
+	SelectProgram(shader, shader->programNoTess);
+	BindVertexArray(capture->vertexArray);
+	glDrawTransformFeedback(GL_LINES, capture->feedback);
+}
+
+void DestroyCurveCapture(MyCurveCapture *capture)
+{
+	BindVertexArray(0);
+	glDeleteVertexArrays(1, &capture->vertexArray);
+	glDeleteBuffers(1, &capture->buffer);
+	glDeleteTransformFeedbacks(1, &capture->feedback);
+	glDeleteQueries(1, &capture->writtenQuery);
+}
+
+// draws patches through the bound tessellation program, recording the
+// resulting lines if a capture is in progress
+void DrawPatches(GLint first, GLsizei count, GLsizei instances = 1)
+{
+	if (capturingCurves) glResumeTransformFeedback();
+	glDrawArraysInstanced(GL_PATCHES, first, count, instances);
+	if (capturingCurves) glPauseTransformFeedback();
+}
+
+// as above, for indexed patches
+void DrawPatchElements(GLsizei count, const void *indices, GLsizei instances, GLint baseVertex)
+{
+	if (capturingCurves) glResumeTransformFeedback();
+	glDrawElementsInstancedBaseVertex(GL_PATCHES, count, GL_UNSIGNED_SHORT, indices, instances, baseVertex);
+	if (capturingCurves) glPauseTransformFeedback();
+}
+
+// --------------------------------------------------------------------------
+// Functions to bake levels into resident buffers
+//
+// Every level's geometry is built once, the curve levels at startup and the
+// text levels as soon as the loader thread has delivered all of their glyphs,
+// so switching levels only changes which bake is drawn. Curves keep their own small buffers; text
+// keeps an instance buffer grouped by glyph, with the glyph meshes themselves
+// living in the glyph heap.
+
+// the instances of one glyph within a level's instance buffer
+struct MyGlyphBatch
+{
+	string  font;
+	uint    index;
+	int     ppem;
+	GLint   base;
+	GLsizei instances;
+};
+
+struct MyLevelBake
+{
+	// false until the level's geometry (and glyphs) are in place
+	bool       baked;
+
+	// degree of the level's curves, or zero for a text level
+	int        degree;
+	MyGeometry curves;
+	MyGeometry polygons;
+	MyGeometry points;
+
+	// glyph instances of a text level, grouped into batches
+	GLuint     instanceBuffer;
+	vector<MyGlyphBatch> batches;
+
+	// bytes held in this level's own buffers
+	GLsizeiptr bytes;
+
+	MyLevelBake() : baked(false), degree(0), instanceBuffer(0), bytes(0)
+	{}
+};
+
+// adds an instance of a glyph at (x, y) with the given scale per EM, in
+// normalized device coordinates, to the batch of that glyph; a composite is
+// added as instances of its components instead
+void AddGlyphInstance(MyGlyphCache *cache, MyLevelBake *bake, vector<vector<MyGlyphInstance> > &batches,
+	map<MyGlyphKey, int> &batchIndex, const MyGlyphKey &key, GLfloat x, GLfloat y, GLfloat scale,
+	const GLfloat *colour, int depth = 0)
+{
+	// make the glyph resident now rather than at its first draw
+	const MyGlyphMesh &mesh = FetchGlyph(cache, key.font, key.index, key.ppem);
+	if (!mesh.components.empty())
+	{
+		if (depth >= MAX_COMPONENT_DEPTH) return;
+		vector<MyGlyphComponent> components(mesh.components);
+		for (uint c = 0; c < components.size(); c++) {
+			MyGlyphKey part(key.font, components[c].index, key.ppem);
+			AddGlyphInstance(cache, bake, batches, batchIndex, part, x + components[c].x * scale,
+				y + components[c].y * scale, scale * components[c].scale, colour, depth + 1);
+		}
+		return;
+	}
+
+	MyGlyphInstance instance = {
+		{ x, y, 0.0f, scale / GLYPH_UNITS_PER_EM },
+		{ colour[0], colour[1], colour[2] }
+	};
+
+	map<MyGlyphKey, int>::iterator it = batchIndex.find(key);
+	if (it == batchIndex.end()) {
+		it = batchIndex.insert(make_pair(key, int(bake->batches.size()))).first;
+		MyGlyphBatch batch = { key.font, key.index, key.ppem, 0, 0 };
+		bake->batches.push_back(batch);
+		batches.push_back(vector<MyGlyphInstance>());
+	}
+	batches[it->second].push_back(instance);
+}
+
+// lays out lines of text, grouping the instances of each unique glyph in order
+// of first appearance, and uploads them to the level's instance buffer
+void BakeText(MyGlyphCache *cache, MyLevelBake *bake, const MyTextRun *runs, int runCount)
+{
+	vector<vector<MyGlyphInstance> > batches;
+	map<MyGlyphKey, int> batchIndex;
+	for (int r = 0; r < runCount; r++)
+	{
+		const MyTextRun &run = runs[r];
+		GLfloat pen = run.x;
+		const MyFallbackGlyph *previous = 0;
+		for (uint i = 0; i < run.text.size(); i++)
+		{
+			const MyFallbackGlyph *glyph = ResolveGlyph(cache, run.font, run.text[i]);
+			if (!glyph) continue;
+			if (previous && previous->font == glyph->font)
+				pen += GlyphKerning(cache, glyph->font, previous->index, glyph->index) * run.scale;
+			previous = glyph;
+			MyGlyphKey key(glyph->font, glyph->index, run.ppem);
+			AddGlyphInstance(cache, bake, batches, batchIndex, key, pen, run.y, run.scale, run.colour);
+			pen += glyph->advance * run.scale;
+		}
+	}
+
+	// pack the batches contiguously and upload them in one go
+	vector<MyGlyphInstance> instances;
+	for (uint b = 0; b < batches.size(); b++) {
+		bake->batches[b].base = instances.size();
+		bake->batches[b].instances = batches[b].size();
+		instances.insert(instances.end(), batches[b].begin(), batches[b].end());
+	}
+	if (instances.empty()) return;
+
+	glGenBuffers(1, &bake->instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, bake->instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(MyGlyphInstance), instances.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	bake->bytes += instances.size() * sizeof(MyGlyphInstance);
+}
+
+void DestroyLevelBake(MyLevelBake *bake)
+{
+	DestroyGeometry(&bake->curves);
+	DestroyGeometry(&bake->polygons);
+	DestroyGeometry(&bake->points);
+	glDeleteBuffers(1, &bake->instanceBuffer);
+	bake->batches.clear();
+	bake->baked = false;
+}
+
+// --------------------------------------------------------------------------
+// Rendering function that draws our scene to the frame buffer
+
+// parts of a scene to draw: the tessellated curves, the untessellated lines
+// and points drawn over them, or both
+enum MyPass { PASS_CURVES = 1, PASS_OVERLAY = 2, PASS_ALL = 3 };
+
+/*void RenderScene(MyGeometry *geometry, MyShader *shader)
+{
+	// clear screen to a dark grey colour
+	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// bind our shader program and the vertex array object containing our
+	// scene geometry, then tell OpenGL to draw our geometry
+	glUseProgram(shader->program);
+	glBindVertexArray(geometry->vertexArray);
+	glDrawArrays(GL_PATCHES, 0, geometry->elementCount);
+	glUseProgram(shader->programNoTess);
+	glDrawArrays(GL_LINE_STRIP, 0, geometry->elementCount);
+	glDrawArrays(GL_POINTS, 0, geometry->elementCount);
+
+	// reset state to default (no shader or geometry bound)
+	glBindVertexArray(0);
+	glUseProgram(0);
+}*/
+
+void RenderBezier(MyGeometry *geometry, MyShader *shader)
+{
+	// bind our shader program and the vertex array object containing our
+	// scene geometry, then tell OpenGL to draw our geometry
+	SelectProgram(shader, shader->program);
+	BindVertexArray(geometry->vertexArray);
+	DrawPatches(0, geometry->elementCount);
+}
+
+void RenderControlPoints(MyGeometry *geometry, MyShader *shader)
+{
+	// bind our shader program and the vertex array object containing our
+	// scene geometry, then tell OpenGL to draw our geometry
+	SelectProgram(shader, shader->programNoTess);
+	BindVertexArray(geometry->vertexArray);
+	glDrawArrays(GL_POINTS, 0, geometry->elementCount);
+}
+
+void RenderControlLines(MyGeometry *geometry, MyShader *shader)
+{
+	// bind our shader program and the vertex array object containing our
+	// scene geometry, then tell OpenGL to draw our geometry
+	SelectProgram(shader, shader->programNoTess);
+	BindVertexArray(geometry->vertexArray);
+	glDrawArrays(GL_LINES, 0, geometry->elementCount);
+}
+
+// draws the baked text of a level as instances of glyphs resident in the
+// glyph heap, one instanced call per unique glyph and segment degree
+void RenderText(MyGlyphCache *cache, MyShader *shader, MyLevelBake *bake, int passes = PASS_ALL)
+{
+	const GLuint COLOUR_INDEX = 1;
+	const GLuint TRANSFORM_INDEX = 2;
+
+	if (bake->batches.empty()) return;
+
+	// look the meshes up again each frame, as the heap may have moved or
+	// evicted them since the level was baked
+	vector<const MyGlyphMesh *> meshes(bake->batches.size());
+	for (uint b = 0; b < bake->batches.size(); b++)
+		meshes[b] = &FetchGlyph(cache, bake->batches[b].font, bake->batches[b].index, bake->batches[b].ppem);
+
+	glBindBuffer(GL_ARRAY_BUFFER, bake->instanceBuffer);
+
+	// draw quadratic and cubic patches through the tessellation program first,
+	// then straight lines and points without tessellation
+	const int order[] = { 2, 3, 1, 0 };
+	for (int o = 0; o < 4; o++)
+	{
+		int d = order[o];
+		if (!(passes & (d >= 2 ? PASS_CURVES : PASS_OVERLAY))) continue;
+
+		GLenum mode = GL_PATCHES;
+		if (d >= 2) {
+			SelectProgram(shader, shader->program);
+			Uniform2f(shader->curvesLocation, d == 3 ? 1.0 : 0.0, 0.0);
+			PatchVertices(d + 1);
+		}
+		else {
+			SelectProgram(shader, shader->programNoTess);
+			mode = (d == 1) ? GL_LINES : GL_POINTS;
+		}
+
+		BindVertexArray(cache->vertexArray);
+		bool deltas = false;
+		for (uint b = 0; b < meshes.size(); b++)
+		{
+			const MyGlyphMesh *mesh = meshes[b];
+			const MyGlyphBatch &batch = bake->batches[b];
+			if (!mesh->count[d]) continue;
+
+			if (mesh->variable != deltas) {
+				deltas = mesh->variable;
+				EnableGlyphDeltas(deltas);
+			}
+
+			// point the per-instance attributes at this glyph's batch
+			GLubyte *offset = 0;
+			offset += batch.base * sizeof(MyGlyphInstance);
+			glVertexAttribPointer(TRANSFORM_INDEX, 4, GL_FLOAT, GL_FALSE, sizeof(MyGlyphInstance), offset);
+			glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(MyGlyphInstance), offset + sizeof(GLfloat[4]));
+			glVertexAttribDivisor(TRANSFORM_INDEX, 1);
+			glVertexAttribDivisor(COLOUR_INDEX, 1);
+			glEnableVertexAttribArray(TRANSFORM_INDEX);
+			glEnableVertexAttribArray(COLOUR_INDEX);
+
+			// indices are relative to the glyph's first control point
+			GLint baseVertex = mesh->offset / GLYPH_VERTEX_SIZE;
+			GLubyte *indices = 0;
+			indices += mesh->offset + mesh->indexStart + mesh->first[d] * sizeof(GLushort);
+			if (mode == GL_PATCHES)
+				DrawPatchElements(mesh->count[d], indices, batch.instances, baseVertex);
+			else
+				glDrawElementsInstancedBaseVertex(mode, mesh->count[d], GL_UNSIGNED_SHORT, indices, batch.instances, baseVertex);
+		}
+		if (deltas) EnableGlyphDeltas(false);
+	}
 
-		for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-		colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-		GenerateQuadratic(&geometry, &shader, vertices, colours);
-		RenderBezier(&geometry, &shader);
-
-		vertices[0][0] = -1.0/scale; vertices[0][1] = 1.0/scale;
-		vertices[1][0] = 0.0/scale;  vertices[1][1] = 1.0/scale;
-		vertices[2][0] = 1.0/scale;  vertices[2][1] = 1.0/scale;
-
-		if(level == 2){
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlLines(&geometry, &shader);
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlPoints(&geometry, &shader);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ClearScene(MyGeometry *geometry, MyShader *shader)
+{
+    // clear screen to a dark grey colour
+    glClearColor(0.2, 0.2, 0.2, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// --------------------------------------------------------------------------
+// Scene descriptions and functions that draw each level
+
+// control points of the quadratic curves of levels 1 and 2, and of the cubic
+// curves of levels 3 and 4, before division by the scene scale
+const GLfloat QUADRATICS[4][3][2] = {
+	{ { 1.0, 1.0 }, { 2.0, -1.0 }, { 0.0, -1.0 } },
+	{ { 0.0, -1.0 }, { -2.0, -1.0 }, { -1.0, 1.0 } },
+	{ { -1.0, 1.0 }, { 0.0, 1.0 }, { 1.0, 1.0 } },
+	{ { 1.2, 0.5 }, { 2.5, 1.0 }, { 1.3, -0.4 } }
+};
+
+const GLfloat CUBICS[5][4][2] = {
+	{ { 1.0, 1.0 }, { 4.0, 0.0 }, { 6.0, 2.0 }, { 9.0, 1.0 } },
+	{ { 8.0, 2.0 }, { 0.0, 8.0 }, { 0.0, -2.0 }, { 8.0, 4.0 } },
+	{ { 5.0, 3.0 }, { 3.0, 2.0 }, { 3.0, 3.0 }, { 5.0, 2.0 } },
+	{ { 3.0, 2.2 }, { 3.5, 2.7 }, { 3.5, 3.3 }, { 3.0, 3.8 } },
+	{ { 2.8, 3.5 }, { 2.4, 3.8 }, { 2.4, 3.2 }, { 2.8, 3.5 } }
+};
+
+static void PushVertex(vector<GLfloat> &vertices, vector<GLfloat> &colours, const GLfloat *point, float scale, GLfloat r, GLfloat g, GLfloat b)
+{
+	vertices.push_back(point[0] / scale);
+	vertices.push_back(point[1] / scale);
+	colours.push_back(r);
+	colours.push_back(g);
+	colours.push_back(b);
+}
+
+// bakes a set of red Bezier curves of one degree, optionally with their
+// yellow control polygons and green/blue control points
+void BakeCurves(MyLevelBake *bake, const GLfloat (*points)[2], int degree, int curveCount, float scale, bool controls)
+{
+	vector<GLfloat> vertices, colours;
+	vector<GLfloat> lineVertices, lineColours;
+	vector<GLfloat> pointVertices, pointColours;
+	int n = degree + 1;
+
+	for (int c = 0; c < curveCount; c++)
+	{
+		const GLfloat (*curve)[2] = points + c*n;
+		for (int i = 0; i < n; i++)
+			PushVertex(vertices, colours, curve[i], scale, 1.0f, 0.0f, 0.0f);
+
+		if (!controls) continue;
+
+		// control polygon as separate line segments
+		for (int i = 0; i + 1 < n; i++) {
+			PushVertex(lineVertices, lineColours, curve[i], scale, 1.0f, 1.0f, 0.0f);
+			PushVertex(lineVertices, lineColours, curve[i+1], scale, 1.0f, 1.0f, 0.0f);
 		}
 
-		for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-		colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-		GenerateQuadratic(&geometry, &shader, vertices, colours);
-		RenderBezier(&geometry, &shader);
-
-		vertices[0][0] = 1.2/scale; vertices[0][1] = 0.5/scale;
-		vertices[1][0] = 2.5/scale;  vertices[1][1] = 1.0/scale;
-		vertices[2][0] = 1.3/scale;  vertices[2][1] = -0.4/scale;
-
-		if(level == 2){
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlLines(&geometry, &shader);
-			for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-			colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][1] = 1.0f;
-			GenerateQuadratic(&geometry, &shader, vertices, colours);
-			RenderControlPoints(&geometry, &shader);
+		// end points in green, interior control points in blue
+		for (int i = 0; i < n; i++) {
+			bool end = (i == 0 || i == n-1);
+			PushVertex(pointVertices, pointColours, curve[i], scale, 0.0f, end ? 1.0f : 0.0f, end ? 0.0f : 1.0f);
 		}
+	}
 
-		for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-		colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
+	bake->degree = degree;
+	GenerateGeometry(&bake->curves, vertices, colours);
+	GenerateGeometry(&bake->polygons, lineVertices, lineColours);
+	GenerateGeometry(&bake->points, pointVertices, pointColours);
+	bake->bytes += (vertices.size() + colours.size() + lineVertices.size() + lineColours.size()
+		+ pointVertices.size() + pointColours.size()) * sizeof(GLfloat);
+}
 
-		GenerateQuadratic(&geometry, &shader, vertices, colours);
-		RenderBezier(&geometry, &shader);
+// fonts installed in the fonts directory, resolved by family and style
+static FontCatalog fontCatalog;
 
+// font files of the name in level 5 and of the scrollers in levels 6 to 8,
+// resolved once the catalog is open
+static string nameFonts[3];
+static string scrollerFonts[3];
 
-			break;
-			case 3 :
-			case 4 :
+void ResolveLevelFonts()
+{
+	const char *names[] = { "Lora", "Source Sans Pro", "Dattermatter Personal Use" };
+	const char *scrollers[] = { "Alex Brush", "Inconsolata", "Fugaz One" };
+	for (int i = 0; i < 3; i++) {
+		nameFonts[i] = fontCatalog.Resolve(names[i], "Regular");
+		scrollerFonts[i] = fontCatalog.Resolve(scrollers[i], "Regular");
+	}
+}
 
-			glUseProgram(shader.program);
-			glUniform2f(loc1, 1.0, 0.0);
-			glUseProgram(shader.programNoTess);
-			glUniform2f(loc2, 1.0, 0.0);
+// text up to this many pixels per EM, which is small enough for grid fitting to
+// matter, is drawn with outlines hinted for its size; larger text keeps its
+// design outlines, which scale cleanly whatever size the window is
+const int HINTED_PPEM_LIMIT = 24;
 
-			glPatchParameteri(GL_PATCH_VERTICES, 4);
+// framebuffer height the text sizes are worked out for, set at startup; only
+// text small enough to be hinted depends on it
+static int textViewportHeight = 0;
 
-			vertices[0][0] = 1.0/scale;  vertices[0][1] = 1.0/scale;
-			vertices[1][0] = 4.0/scale;  vertices[1][1] = 0.0/scale;
-			vertices[2][0] = 6.0/scale;  vertices[2][1] = 2.0/scale;
-			vertices[3][0] = 9.0/scale;  vertices[3][1] = 1.0/scale;
+// pixels per EM to extract glyphs at for text of the given scale, or zero for
+// design outlines
+int TextPixelsPerEm(GLfloat scale)
+{
+	int ppem = int(scale * textViewportHeight / 2 + 0.5f);
+	return (ppem > 0 && ppem <= HINTED_PPEM_LIMIT) ? ppem : 0;
+}
 
-			if(level == 4){
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f; colours[3][0] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlLines(&geometry, &shader);
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][2] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlPoints(&geometry, &shader);
-			}
+// the pangram scrolled across the screen in levels 6 to 8
+MyTextRun ScrollerRun(int level, float scale, float move)
+{
+	const string &font = scrollerFonts[level - 6];
 
-			for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-			GenerateCubic(&geometry, &shader, vertices, colours);
-			RenderBezier(&geometry, &shader);
-
-			vertices[0][0] = 8.0/scale;  vertices[0][1] = 2.0/scale;
-			vertices[1][0] = 0.0/scale;  vertices[1][1] = 8.0/scale;
-			vertices[2][0] = 0.0/scale;  vertices[2][1] = -2.0/scale;
-			vertices[3][0] = 8.0/scale;  vertices[3][1] = 4.0/scale;
-
-			if(level == 4){
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f; colours[3][0] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlLines(&geometry, &shader);
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][2] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlPoints(&geometry, &shader);
-			}
+	MyTextRun run = { font, "thequickbrownfoxjumpsoverthelazydog", -1.0f/scale + move, 0.0f, 1.0f/scale, { 1.0f, 0.0f, 0.0f }, 0 };
+	run.ppem = TextPixelsPerEm(run.scale);
+	return run;
+}
 
-			for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-			GenerateCubic(&geometry, &shader, vertices, colours);
-			RenderBezier(&geometry, &shader);
-
-			vertices[0][0] = 5.0/scale;  vertices[0][1] = 3.0/scale;
-			vertices[1][0] = 3.0/scale;  vertices[1][1] = 2.0/scale;
-			vertices[2][0] = 3.0/scale;  vertices[2][1] = 3.0/scale;
-			vertices[3][0] = 5.0/scale;  vertices[3][1] = 2.0/scale;
-
-			if(level == 4){
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f; colours[3][0] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlLines(&geometry, &shader);
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][2] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlPoints(&geometry, &shader);
-			}
+// the lines of text shown in a level, empty for the curve levels; scrolling
+// text is given at its starting position
+vector<MyTextRun> LevelText(int level, float scale)
+{
+	vector<MyTextRun> runs;
+	if (level == 5)
+	{
+		// the same name in three typefaces, one line each
+		const float translations[] = { 0.75f, 0.0f, -0.75f };
 
-			for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-			GenerateCubic(&geometry, &shader, vertices, colours);
-			RenderBezier(&geometry, &shader);
-
-			vertices[0][0] = 3.0/scale;  vertices[0][1] = 2.2/scale;
-			vertices[1][0] = 3.5/scale;  vertices[1][1] = 2.7/scale;
-			vertices[2][0] = 3.5/scale;  vertices[2][1] = 3.3/scale;
-			vertices[3][0] = 3.0/scale;  vertices[3][1] = 3.8/scale;
-
-			if(level == 4){
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f; colours[3][0] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlLines(&geometry, &shader);
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][2] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlPoints(&geometry, &shader);
-			}
+		for (int name = 0; name < 3; name++) {
+			MyTextRun run = { nameFonts[name], "MatthewHylton", -1.0f/scale, translations[name], 1.0f/scale, { 1.0f, 0.0f, 0.0f }, 0 };
+			run.ppem = TextPixelsPerEm(run.scale);
+			runs.push_back(run);
+		}
+	}
+	else if (level >= 6)
+		runs.push_back(ScrollerRun(level, scale, 0.0f));
+	return runs;
+}
 
-			for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-			GenerateCubic(&geometry, &shader, vertices, colours);
-			RenderBezier(&geometry, &shader);
-
-			vertices[0][0] = 2.8/scale;  vertices[0][1] = 3.5/scale;
-			vertices[1][0] = 2.4/scale;  vertices[1][1] = 3.8/scale;
-			vertices[2][0] = 2.4/scale;  vertices[2][1] = 3.2/scale;
-			vertices[3][0] = 2.8/scale;  vertices[3][1] = 3.5/scale;
-
-			if(level == 4){
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][0] = 1.0f; colours[0][1] = 1.0f; colours[1][0] = 1.0f; colours[1][1] = 1.0f; colours[2][0] = 1.0f; colours[2][1] = 1.0f; colours[3][0] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlLines(&geometry, &shader);
-				for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-				colours[0][1] = 1.0f; colours[1][2] = 1.0f; colours[2][2] = 1.0f; colours[3][1] = 1.0f;
-				GenerateCubic(&geometry, &shader, vertices, colours);
-				RenderControlPoints(&geometry, &shader);
+// the glyphs used by all levels, one request per font and size, for the loader
+// thread, which draws characters a run's font lacks from the fallback chain
+vector<MyGlyphRequest> LevelGlyphRequests(float scale)
+{
+	vector<MyGlyphRequest> requests;
+	for (int l = 1; l <= 8; l++)
+	{
+		vector<MyTextRun> runs = LevelText(l, scale);
+		for (uint r = 0; r < runs.size(); r++)
+		{
+			for (uint i = 0; i < runs[r].text.size(); i++)
+			{
+				char c = runs[r].text[i];
+				uint q = 0;
+				while (q < requests.size() && (requests[q].font != runs[r].font || requests[q].ppem != runs[r].ppem)) q++;
+				if (q == requests.size()) {
+					MyGlyphRequest request = { runs[r].font, "", runs[r].ppem };
+					requests.push_back(request);
+				}
+				if (requests[q].characters.find(c) == string::npos)
+					requests[q].characters += c;
 			}
+		}
+	}
+	return requests;
+}
 
-			for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-			colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-			GenerateCubic(&geometry, &shader, vertices, colours);
-			RenderBezier(&geometry, &shader);
-
-			break;
-			case 5 :
-{
-			for (int name = 0; name < 3; name++) {
-				float translation;
-				if(name == 0){
-						extractor.LoadFontFile("fonts/Lora-Regular.ttf");
-						translation = 0.75f;}
-					else if(name == 1){
-						extractor.LoadFontFile("fonts/SourceSansPro-Regular.ttf");
-						translation = 0.0f;}
-					else {
-						extractor.LoadFontFile("fonts/Dattermatter Personal Use.ttf");
-						translation = -0.75f;}
-				float advance = -1;
-
-			for (int letter = 0; letter < 13; letter++) {
-				MyGlyph glyph;
-			switch (letter) {
-				case 0 :
-				glyph = extractor.ExtractGlyph('M'); break;
-				case 1 :
-				glyph = extractor.ExtractGlyph('a'); break;
-				case 2 :
-				glyph = extractor.ExtractGlyph('t'); break;
-				case 3 :
-				glyph = extractor.ExtractGlyph('t'); break;
-				case 4 :
-				glyph = extractor.ExtractGlyph('h'); break;
-				case 5 :
-				glyph = extractor.ExtractGlyph('e'); break;
-				case 6 :
-				glyph = extractor.ExtractGlyph('w'); break;
-				case 7 :
-				glyph = extractor.ExtractGlyph('H'); break;
-				case 8 :
-				glyph = extractor.ExtractGlyph('y'); break;
-				case 9 :
-				glyph = extractor.ExtractGlyph('l'); break;
-				case 10 :
-				glyph = extractor.ExtractGlyph('t'); break;
-				case 11 :
-				glyph = extractor.ExtractGlyph('o'); break;
-				case 12 :
-				glyph = extractor.ExtractGlyph('n'); break;
-			}
+// true once every glyph of a level's text can be fetched without stalling
+bool LevelAvailable(int level, MyGlyphCache *glyphs, float scale)
+{
+	vector<MyTextRun> runs = LevelText(level, scale);
+	for (uint r = 0; r < runs.size(); r++)
+		for (uint i = 0; i < runs[r].text.size(); i++)
+		{
+			const MyFallbackGlyph *glyph = ResolveGlyph(glyphs, runs[r].font, runs[r].text[i]);
+			if (!glyph || !GlyphAvailable(glyphs, glyph->font, glyph->index, runs[r].ppem))
+				return false;
+		}
+	return true;
+}
 
-			for (uint i = 0; i < glyph.contours.size(); i++) {
-				for (uint j = 0; j < glyph.contours[i].size(); j++) {
-					//cout << j << " " << i << " " << glyph.contours[i][j].degree << " " << glyph.contours[i][j].x[0] << " " << glyph.contours[i][j].x[1] << " " << glyph.contours[i][j].y[0] << " " << glyph.contours[i][j].y[1] << endl;
-
-					uint degree = glyph.contours[i][j].degree;
-					switch (degree) {
-						case 0:
-						vertices[0][0] = (float)(glyph.contours[i][j].x[0]+advance)/scale;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-						for (int i = 0; i < 1; i++){for (int j = 0; j < 1; j++){colours[i][j] = 0.0f;}}
-						colours[0][0] = 1.0f;
-						GeneratePoint(&geometry, &shader, vertices, colours);
-						RenderControlPoints(&geometry, &shader);
-
-						break;
-						case 1:
-						vertices[0][0] = (float)(glyph.contours[i][j].x[0]+advance)/scale;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-						vertices[1][0] = (float)(glyph.contours[i][j].x[1]+advance)/scale;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-
-						for (int i = 0; i < 2; i++){for (int j = 0; j < 2; j++){colours[i][j] = 0.0f;}}
-						colours[0][0] = 1.0f; colours[1][0] = 1.0f;
-
-						Generateline(&geometry, &shader, vertices, colours);
-						RenderControlLines(&geometry, &shader);
-						break;
-						case 2:
-						glUseProgram(shader.program);
-						glUniform2f(loc1, 0.0, 0.0);
-						glPatchParameteri(GL_PATCH_VERTICES, 3);
-
-						vertices[0][0] = (float)(glyph.contours[i][j].x[0]+advance)/scale;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-						vertices[1][0] = (float)(glyph.contours[i][j].x[1]+advance)/scale;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-						vertices[2][0] = (float)(glyph.contours[i][j].x[2]+advance)/scale;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-
-						for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-						colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-						GenerateQuadratic(&geometry, &shader, vertices, colours);
-						RenderBezier(&geometry, &shader);
-						break;
-						case 3:
-						glUseProgram(shader.program);
-						glUniform2f(loc1, 1.0, 0.0);
-						glPatchParameteri(GL_PATCH_VERTICES, 4);
-
-						vertices[0][0] = (float)(glyph.contours[i][j].x[0]+advance)/scale;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-						vertices[1][0] = (float)(glyph.contours[i][j].x[1]+advance)/scale;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-						vertices[2][0] = (float)(glyph.contours[i][j].x[2]+advance)/scale;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-						vertices[3][0] = (float)(glyph.contours[i][j].x[3]+advance)/scale;  vertices[3][1] = (float)(glyph.contours[i][j].y[3]+(translation*scale))/scale;
-
-						for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-						colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-						GenerateCubic(&geometry, &shader, vertices, colours);
-						RenderBezier(&geometry, &shader);
-						break;
-					}
-				}
-			}
-			advance = advance + glyph.advance;
+// builds the resident buffers of one level; text is baked at its starting
+// position and scrolled with the shader's offset
+void BakeLevel(MyLevelBake *bake, int level, MyGlyphCache *glyphs, float scale)
+{
+	GLsizeiptr heapUsed = glyphs->heap.used;
+
+	if (level <= 2)
+		BakeCurves(bake, QUADRATICS[0], 2, 4, scale, level == 2);
+	else if (level <= 4)
+		BakeCurves(bake, CUBICS[0], 3, 5, scale, level == 4);
+	else {
+		vector<MyTextRun> runs = LevelText(level, scale);
+		BakeText(glyphs, bake, runs.data(), runs.size());
+	}
+	bake->baked = true;
+
+	cout << "Level " << level << " baked: " << bake->bytes << " bytes resident, "
+		<< (glyphs->heap.used - heapUsed) << " bytes of new glyphs" << endl;
+}
+
+void RenderLevel(MyLevelBake *bake, int passes, MyGlyphCache *glyphs, MyShader *shader)
+{
+	if (bake->degree)
+	{
+		if (passes & PASS_CURVES) {
+			SelectProgram(shader, shader->program);
+			Uniform2f(shader->curvesLocation, bake->degree == 3 ? 1.0 : 0.0, 0.0);
+			PatchVertices(bake->degree + 1);
+			RenderBezier(&bake->curves, shader);
+		}
+		if (passes & PASS_OVERLAY) {
+			RenderControlLines(&bake->polygons, shader);
+			RenderControlPoints(&bake->points, shader);
 		}
 	}
+	else
+		RenderText(glyphs, shader, bake, passes);
 }
-			break;
-			case 6:
-			if (end){
-				move = 1.0;
-				end = false;
-				g = false;
-			}
-			else{
-					move = move - rate;
-				}
+
+// --------------------------------------------------------------------------
+// Frame scheduling
+//
+// Animation advances in fixed steps of simulated time, however many frames
+// are actually drawn, so the scrollers move at the same speed with or
+// without vsync. Frame times are gathered while drawing continuously.
+
+struct MyFrameClock
 {
-						extractor.LoadFontFile("fonts/AlexBrush-Regular.ttf");
-						float advance = -1;
-						float translation = 0.0;
-
-						for (int letter = 0; letter < 36; letter++) {
-							MyGlyph glyph;
-						switch (letter) {
-							case 30 :
-							glyph = extractor.ExtractGlyph('a'); break;
-							case 9 :
-							glyph = extractor.ExtractGlyph('b'); break;
-							case 7 :
-							glyph = extractor.ExtractGlyph('c'); break;
-							case 33 :
-							glyph = extractor.ExtractGlyph('d'); break;
-							case 3 :
-							case 24 :
-							case 28 :
-							glyph = extractor.ExtractGlyph('e'); break;
-							case 14 :
-							glyph = extractor.ExtractGlyph('f'); break;
-							case 35 :
-							glyph = extractor.ExtractGlyph('g'); g = true; break;
-							case 2 :
-							case 27 :
-							glyph = extractor.ExtractGlyph('h'); break;
-							case 6 :
-							glyph = extractor.ExtractGlyph('i'); break;
-							case 17 :
-							glyph = extractor.ExtractGlyph('j'); break;
-							case 8 :
-							glyph = extractor.ExtractGlyph('k'); break;
-							case 29 :
-							glyph = extractor.ExtractGlyph('l'); break;
-							case 19 :
-							glyph = extractor.ExtractGlyph('m'); break;
-							case 13 :
-							glyph = extractor.ExtractGlyph('n'); break;
-							case 11 :
-							case 15 :
-							case 22 :
-							case 34 :
-							glyph = extractor.ExtractGlyph('o'); break;
-							case 20 :
-							glyph = extractor.ExtractGlyph('p'); break;
-							case 4 :
-							glyph = extractor.ExtractGlyph('q'); break;
-							case 10 :
-							case 25 :
-							glyph = extractor.ExtractGlyph('r'); break;
-							case 21 :
-							glyph = extractor.ExtractGlyph('s'); break;
-							case 1 :
-							case 26 :
-							glyph = extractor.ExtractGlyph('t'); break;
-							case 5 :
-							case 18 :
-							glyph = extractor.ExtractGlyph('u'); break;
-							case 23 :
-							glyph = extractor.ExtractGlyph('v'); break;
-							case 12 :
-							glyph = extractor.ExtractGlyph('w'); break;
-							case 16 :
-							glyph = extractor.ExtractGlyph('x'); break;
-							case 32 :
-							glyph = extractor.ExtractGlyph('y'); break;
-							case 31 :
-							glyph = extractor.ExtractGlyph('z'); break;
-						}
-
-						for (uint i = 0; i < glyph.contours.size(); i++) {
-							for (uint j = 0; j < glyph.contours[i].size(); j++) {
-								//cout << j << " " << i << " " << glyph.contours[i][j].degree << " " << glyph.contours[i][j].x[0] << " " << glyph.contours[i][j].x[1] << " " << glyph.contours[i][j].y[0] << " " << glyph.contours[i][j].y[1] << endl;
-
-								uint degree = glyph.contours[i][j].degree;
-								switch (degree) {
-									case 0:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									for (int i = 0; i < 1; i++){for (int j = 0; j < 1; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f;
-									GeneratePoint(&geometry, &shader, vertices, colours);
-									RenderControlPoints(&geometry, &shader);
-
-									break;
-									case 1:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-
-									for (int i = 0; i < 2; i++){for (int j = 0; j < 2; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f;
-
-									Generateline(&geometry, &shader, vertices, colours);
-									RenderControlLines(&geometry, &shader);
-									break;
-									case 2:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 0.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 3);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-
-									for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-									GenerateQuadratic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-
-									if(g)
-										if(vertices[0][0] < -3.0)
-											end = true;
-									break;
-									case 3:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 1.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 4);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-									vertices[3][0] = (float)((glyph.contours[i][j].x[3]+advance)/scale)+move;  vertices[3][1] = (float)(glyph.contours[i][j].y[3]+(translation*scale))/scale;
-
-									for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-									GenerateCubic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-									break;
-								}
-							}
-						}
-						advance = advance + glyph.advance;
-					}
-				}
-			break;
-			case 7:
-			if (end){
-				move = 1.0;
-				end = false;
-				g = false;
-			}
-			else{
-					move = move - rate;
-				}
+	// length of one animation step, and simulated time not yet stepped
+	double step;
+	double accumulator;
+
+	// time the last frame started, or negative after an idle period
+	double last;
+
+	// pacing statistics since the last report, in seconds
+	unsigned int frames;
+	double total;
+	double sumSquares;
+	double shortest;
+	double longest;
+
+	// CPU time spent building the frames drawn, from start to buffer swap
+	unsigned int cpuFrames;
+	double cpuTotal;
+
+	MyFrameClock() : step(1.0 / 60.0), accumulator(0), last(-1),
+		frames(0), total(0), sumSquares(0), shortest(0), longest(0),
+		cpuFrames(0), cpuTotal(0)
+	{}
+};
+
+// starts a frame at the given time, returning the number of animation steps
+// to take; frames drawn after idling do not count towards pacing
+int AdvanceFrameClock(MyFrameClock *clock, double now, bool continuous)
+{
+	if (!continuous || clock->last < 0) {
+		clock->accumulator = 0;
+		clock->last = continuous ? now : -1;
+		return 0;
+	}
+
+	double elapsed = now - clock->last;
+	clock->last = now;
+
+	if (!clock->frames || elapsed < clock->shortest) clock->shortest = elapsed;
+	if (!clock->frames || elapsed > clock->longest) clock->longest = elapsed;
+	clock->frames++;
+	clock->total += elapsed;
+	clock->sumSquares += elapsed * elapsed;
+
+	// after a long stall, drop the backlog rather than racing to catch up
+	clock->accumulator = min(clock->accumulator + elapsed, 0.25);
+	int steps = int(clock->accumulator / clock->step);
+	clock->accumulator -= steps * clock->step;
+	return steps;
+}
+
+// prints and resets the pacing statistics, along with the CPU and GPU time
+// per frame
+void ReportFramePacing(MyFrameClock *clock, MyFramePipeline *pipeline)
+{
+	if (clock->cpuFrames && pipeline->gpuFrames) {
+		cout << "Frame work: " << clock->cpuTotal / clock->cpuFrames * 1000.0 << " ms CPU, "
+			<< pipeline->gpuTotal / pipeline->gpuFrames * 1000.0 << " ms GPU, "
+			<< pipeline->stalls << " fence stalls, " << pipeline->overflows << " staging overflows" << endl;
+	}
+	clock->cpuFrames = 0;
+	clock->cpuTotal = 0;
+	pipeline->gpuFrames = 0;
+	pipeline->gpuTotal = 0;
+	pipeline->stalls = pipeline->overflows = 0;
+
+	if (!clock->frames) {
+		cout << "Frame pacing: no continuous frames drawn" << endl;
+		return;
+	}
+
+	double mean = clock->total / clock->frames;
+	double deviation = sqrt(max(clock->sumSquares / clock->frames - mean * mean, 0.0));
+	cout << "Frame pacing over " << clock->frames << " frames (swap interval "
+		<< swapInterval << "): " << 1.0 / mean << " fps, "
+		<< mean * 1000.0 << " ms mean, " << deviation * 1000.0 << " ms deviation, "
+		<< clock->shortest * 1000.0 << " - " << clock->longest * 1000.0 << " ms range" << endl;
+
+	clock->frames = 0;
+	clock->total = clock->sumSquares = 0;
+}
+
+// --------------------------------------------------------------------------
+// GLFW callback functions
+
+// reports GLFW errors
+void ErrorCallback(int error, const char* description)
+{
+	cout << "GLFW ERROR " << error << ":" << endl;
+	cout << description << endl;
+}
+
+// input events, handed from the GLFW callbacks to the render loop
+enum MyInputType { INPUT_KEY, INPUT_REDRAW };
+
+struct MyInputEvent
+{
+	MyInputType type;
+	int key;
+	int action;
+};
+
+static SpscQueue<MyInputEvent> inputEvents(256);
+
+// queues an input event; should the render loop fall this far behind, the
+// event is dropped rather than blocking the callback
+void PostInputEvent(MyInputType type, int key = 0, int action = 0)
+{
+	MyInputEvent event = { type, key, action };
+	if (!inputEvents.Push(std::move(event)))
+		cout << "Input queue full, event dropped" << endl;
+}
+
+// applies a keyboard event to the render loop's settings
+void HandleKey(GLFWwindow* window, int key, int action)
+{
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, GL_TRUE);
+
+    if (action == GLFW_PRESS)
+    {
+      redraw = true;
+      switch (key)
+      {
+        case GLFW_KEY_RIGHT :
+        if (level < 8)
+          level++;
+				else
+					level = 1;
+        break;
+        case GLFW_KEY_LEFT :
+        if (level > 1)
+          level--;
+				else
+					level = 8;
+        break;
+				case GLFW_KEY_UP :
+        	rate = rate + 0.01;
+        break;
+				case GLFW_KEY_DOWN :
+        	rate = rate - 0.01;
+        break;
+				case GLFW_KEY_S :
+					cout << "State calls last frame: " << glState.lastIssued << " issued, "
+						<< glState.lastElided << " elided" << endl;
+        break;
+				case GLFW_KEY_T :
+					captureCurves = !captureCurves;
+					cout << "Static curve capture " << (captureCurves ? "on" : "off") << endl;
+        break;
+				case GLFW_KEY_V :
+					swapInterval = swapInterval ? 0 : 1;
+					glfwSwapInterval(swapInterval);
+					cout << "Swap interval " << swapInterval << (swapInterval ? "" : " (uncapped)") << endl;
+        break;
+				case GLFW_KEY_P :
+					reportPacing = true;
+        break;
+				case GLFW_KEY_D :
+					renderOnDemand = !renderOnDemand;
+					cout << "Render on demand " << (renderOnDemand ? "on" : "off") << endl;
+        break;
+				case GLFW_KEY_G :
+					reportGlyphs = true;
+        break;
+				case GLFW_KEY_A :
+					sweepAxes = !sweepAxes;
+					cout << "Variation axis sweep " << (sweepAxes ? "on" : "off") << endl;
+        break;
+      }
+    }
+}
+
+// applies all queued input events, called by the render loop once per iteration
+void ProcessInputEvents(GLFWwindow* window)
+{
+	MyInputEvent event;
+	while (inputEvents.Pop(event)) {
+		if (event.type == INPUT_KEY)
+			HandleKey(window, event.key, event.action);
+		else
+			redraw = true;
+	}
+}
+
+// handles keyboard input events
+void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	PostInputEvent(INPUT_KEY, key, action);
+}
+
+// redraws when the window is resized, or uncovered and needs repainting
+void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+	PostInputEvent(INPUT_REDRAW);
+}
+
+void WindowRefreshCallback(GLFWwindow* window)
+{
+	PostInputEvent(INPUT_REDRAW);
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
 {
-						extractor.LoadFontFile("fonts/Inconsolata-Regular.ttf");
-						float advance = -1;
-						float translation = 0.0;
-
-						for (int letter = 0; letter < 36; letter++) {
-							MyGlyph glyph;
-						switch (letter) {
-							case 30 :
-							glyph = extractor.ExtractGlyph('a'); break;
-							case 9 :
-							glyph = extractor.ExtractGlyph('b'); break;
-							case 7 :
-							glyph = extractor.ExtractGlyph('c'); break;
-							case 33 :
-							glyph = extractor.ExtractGlyph('d'); break;
-							case 3 :
-							case 24 :
-							case 28 :
-							glyph = extractor.ExtractGlyph('e'); break;
-							case 14 :
-							glyph = extractor.ExtractGlyph('f'); break;
-							case 35 :
-							glyph = extractor.ExtractGlyph('g'); g = true; break;
-							case 2 :
-							case 27 :
-							glyph = extractor.ExtractGlyph('h'); break;
-							case 6 :
-							glyph = extractor.ExtractGlyph('i'); break;
-							case 17 :
-							glyph = extractor.ExtractGlyph('j'); break;
-							case 8 :
-							glyph = extractor.ExtractGlyph('k'); break;
-							case 29 :
-							glyph = extractor.ExtractGlyph('l'); break;
-							case 19 :
-							glyph = extractor.ExtractGlyph('m'); break;
-							case 13 :
-							glyph = extractor.ExtractGlyph('n'); break;
-							case 11 :
-							case 15 :
-							case 22 :
-							case 34 :
-							glyph = extractor.ExtractGlyph('o'); break;
-							case 20 :
-							glyph = extractor.ExtractGlyph('p'); break;
-							case 4 :
-							glyph = extractor.ExtractGlyph('q'); break;
-							case 10 :
-							case 25 :
-							glyph = extractor.ExtractGlyph('r'); break;
-							case 21 :
-							glyph = extractor.ExtractGlyph('s'); break;
-							case 1 :
-							case 26 :
-							glyph = extractor.ExtractGlyph('t'); break;
-							case 5 :
-							case 18 :
-							glyph = extractor.ExtractGlyph('u'); break;
-							case 23 :
-							glyph = extractor.ExtractGlyph('v'); break;
-							case 12 :
-							glyph = extractor.ExtractGlyph('w'); break;
-							case 16 :
-							glyph = extractor.ExtractGlyph('x'); break;
-							case 32 :
-							glyph = extractor.ExtractGlyph('y'); break;
-							case 31 :
-							glyph = extractor.ExtractGlyph('z'); break;
-						}
-
-						for (uint i = 0; i < glyph.contours.size(); i++) {
-							for (uint j = 0; j < glyph.contours[i].size(); j++) {
-								//cout << j << " " << i << " " << glyph.contours[i][j].degree << " " << glyph.contours[i][j].x[0] << " " << glyph.contours[i][j].x[1] << " " << glyph.contours[i][j].y[0] << " " << glyph.contours[i][j].y[1] << endl;
-
-								uint degree = glyph.contours[i][j].degree;
-								switch (degree) {
-									case 0:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									for (int i = 0; i < 1; i++){for (int j = 0; j < 1; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f;
-									GeneratePoint(&geometry, &shader, vertices, colours);
-									RenderControlPoints(&geometry, &shader);
-
-									break;
-									case 1:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-
-									for (int i = 0; i < 2; i++){for (int j = 0; j < 2; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f;
-
-									Generateline(&geometry, &shader, vertices, colours);
-									RenderControlLines(&geometry, &shader);
-									break;
-									case 2:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 0.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 3);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-
-									for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-									GenerateQuadratic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-
-									if(g)
-										if(vertices[0][0] < -3.0)
-											end = true;
-									break;
-									case 3:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 1.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 4);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-									vertices[3][0] = (float)((glyph.contours[i][j].x[3]+advance)/scale)+move;  vertices[3][1] = (float)(glyph.contours[i][j].y[3]+(translation*scale))/scale;
-
-									for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-									GenerateCubic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-									break;
-								}
-							}
-						}
-						advance = advance + glyph.advance;
-					}
+	// initialize the GLFW windowing system
+	if (!glfwInit()) {
+		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
+		return -1;
+	}
+	glfwSetErrorCallback(ErrorCallback);
+
+	// attempt to create a window with an OpenGL 4.1 core profile context
+	GLFWwindow *window = 0;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifndef NDEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+#endif
+	window = glfwCreateWindow(1920, 1080, "CPSC 453 Assignment #3", 0, 0);
+	if (!window) {
+		cout << "Program failed to create GLFW window, TERMINATING" << endl;
+		glfwTerminate();
+		return -1;
+	}
+
+	// set keyboard callback function and make our context current (active)
+	glfwSetKeyCallback(window, KeyCallback);
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
+	glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
+	glfwMakeContextCurrent(window);
+
+	// vsync by default; "--swap-interval 0" runs uncapped for benchmarking,
+	// "--threads N" sets the number of glyph workers (default one per core),
+	// and "--glyph-budget N" the kilobytes of packed glyphs kept on the CPU
+	int glyphThreads = 0;
+	size_t glyphBudget = 8 << 20;
+	for (int a = 1; a + 1 < argc; a++) {
+		if (string(argv[a]) == "--swap-interval")
+			swapInterval = max(atoi(argv[a+1]), 0);
+		if (string(argv[a]) == "--threads")
+			glyphThreads = max(atoi(argv[a+1]), 0);
+		if (string(argv[a]) == "--glyph-budget")
+			glyphBudget = size_t(max(atoi(argv[a+1]), 0)) << 10;
+	}
+	glfwSwapInterval(swapInterval);
+
+	// query and print out information about our OpenGL environment
+	QueryGLVersion();
+	InitializeDebugOutput();
+
+	// call function to load and compile shader programs
+	MyShader shader;
+	if (!InitializeShaders(&shader)) {
+		cout << "Program could not initialize shaders, TERMINATING" << endl;
+		return -1;
+	}
+
+	// call function to create and fill buffers with geometry data
+	MyGeometry geometry;
+//	if (!InitializeGeometry(&geometry))
+//		cout << "Program failed to intialize geometry!" << endl;
+
+	glPointSize(5);
+
+	float scale = 10.0f;
+	float move = 1.0;
+	float axisPhase = 0.0;
+
+	// glyph meshes are extracted and uploaded once into the glyph heap, then
+	// drawn as instances
+	MyGlyphCache glyphs;
+	InitializeGlyphCache(&glyphs, 4 << 20, glyphBudget);
+
+	// index the fonts directory, rescanning only fonts that changed
+	fontCatalog.Open("fonts", "fonts/catalog.idx");
+	ResolveLevelFonts();
+
+	// characters missing from a level's font are drawn from the text faces
+	vector<string> chain;
+	chain.push_back(fontCatalog.Resolve("Lora", "Regular"));
+	chain.push_back(fontCatalog.Resolve("Source Sans Pro", "Regular"));
+	chain.push_back(fontCatalog.Resolve("Inconsolata", "Regular"));
+
+	// small text is hinted for the size it is first shown at
+	int framebufferWidth;
+	glfwGetFramebufferSize(window, &framebufferWidth, &textViewportHeight);
+
+	// up to three frames in flight, with glyph uploads staged through a ring
+	MyFramePipeline pipeline;
+	InitializeFramePipeline(&pipeline, 1 << 20);
+	glyphs.pipeline = &pipeline;
+
+	// extract the glyphs of every level in the background, waking the event
+	// loop as each one arrives
+	GlyphLoader loader;
+	loader.Start(LevelGlyphRequests(scale), chain, glfwPostEmptyEvent, glyphThreads);
+
+	// levels are baked once so that switching between them never stalls;
+	// text levels wait for their glyphs, and show nothing until then
+	MyLevelBake levels[8];
+	int levelsBaked = 0;
+
+	// tessellated curves of the static levels are recorded once and replayed
+	MyCurveCapture capture;
+	InitializeCurveCapture(&capture, 16 << 20);
+	int width = 0, height = 0;
+
+	MyFrameClock clock;
+
+	// run an event-triggered main loop
+	while (!glfwWindowShouldClose(window))
+	{
+		ProcessInputEvents(window);
+		BeginPipelinedFrame(&pipeline);
+
+		// bake any level whose glyphs have all arrived; should the loader
+		// have given up on a font, its glyphs are extracted here instead
+		if (levelsBaked < 8)
+		{
+			ReceiveGlyphs(&glyphs, &loader);
+			bool loaderDone = loader.Finished();
+			for (int l = 1; l <= 8; l++)
+			{
+				if (levels[l-1].baked) continue;
+				if (!loaderDone && !LevelAvailable(l, &glyphs, scale)) continue;
+				BakeLevel(&levels[l-1], l, &glyphs, scale);
+				redraw = true;
+				if (++levelsBaked == 8) {
+					GLsizeiptr bakedBytes = 0;
+					for (int b = 0; b < 8; b++) bakedBytes += levels[b].bytes;
+					cout << "All levels baked: " << bakedBytes << " bytes in level buffers, "
+						<< glyphs.heap.used << " bytes of glyphs" << endl;
 				}
-			break;
-			case 8:
-			if (end){
-				move = 1.0;
-				end = false;
-				g = false;
 			}
-			else{
-					move = move - rate;
-				}
-{
-						extractor.LoadFontFile("fonts/FugazOne-Regular.ttf");
-						float advance = -1;
-						float translation = 0.0;
-
-						for (int letter = 0; letter < 36; letter++) {
-							MyGlyph glyph;
-						switch (letter) {
-							case 30 :
-							glyph = extractor.ExtractGlyph('a'); break;
-							case 9 :
-							glyph = extractor.ExtractGlyph('b'); break;
-							case 7 :
-							glyph = extractor.ExtractGlyph('c'); break;
-							case 33 :
-							glyph = extractor.ExtractGlyph('d'); break;
-							case 3 :
-							case 24 :
-							case 28 :
-							glyph = extractor.ExtractGlyph('e'); break;
-							case 14 :
-							glyph = extractor.ExtractGlyph('f'); break;
-							case 35 :
-							glyph = extractor.ExtractGlyph('g'); g = true; break;
-							case 2 :
-							case 27 :
-							glyph = extractor.ExtractGlyph('h'); break;
-							case 6 :
-							glyph = extractor.ExtractGlyph('i'); break;
-							case 17 :
-							glyph = extractor.ExtractGlyph('j'); break;
-							case 8 :
-							glyph = extractor.ExtractGlyph('k'); break;
-							case 29 :
-							glyph = extractor.ExtractGlyph('l'); break;
-							case 19 :
-							glyph = extractor.ExtractGlyph('m'); break;
-							case 13 :
-							glyph = extractor.ExtractGlyph('n'); break;
-							case 11 :
-							case 15 :
-							case 22 :
-							case 34 :
-							glyph = extractor.ExtractGlyph('o'); break;
-							case 20 :
-							glyph = extractor.ExtractGlyph('p'); break;
-							case 4 :
-							glyph = extractor.ExtractGlyph('q'); break;
-							case 10 :
-							case 25 :
-							glyph = extractor.ExtractGlyph('r'); break;
-							case 21 :
-							glyph = extractor.ExtractGlyph('s'); break;
-							case 1 :
-							case 26 :
-							glyph = extractor.ExtractGlyph('t'); break;
-							case 5 :
-							case 18 :
-							glyph = extractor.ExtractGlyph('u'); break;
-							case 23 :
-							glyph = extractor.ExtractGlyph('v'); break;
-							case 12 :
-							glyph = extractor.ExtractGlyph('w'); break;
-							case 16 :
-							glyph = extractor.ExtractGlyph('x'); break;
-							case 32 :
-							glyph = extractor.ExtractGlyph('y'); break;
-							case 31 :
-							glyph = extractor.ExtractGlyph('z'); break;
-						}
-
-						for (uint i = 0; i < glyph.contours.size(); i++) {
-							for (uint j = 0; j < glyph.contours[i].size(); j++) {
-								//cout << j << " " << i << " " << glyph.contours[i][j].degree << " " << glyph.contours[i][j].x[0] << " " << glyph.contours[i][j].x[1] << " " << glyph.contours[i][j].y[0] << " " << glyph.contours[i][j].y[1] << endl;
-
-								uint degree = glyph.contours[i][j].degree;
-								switch (degree) {
-									case 0:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									for (int i = 0; i < 1; i++){for (int j = 0; j < 1; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f;
-									GeneratePoint(&geometry, &shader, vertices, colours);
-									RenderControlPoints(&geometry, &shader);
-
-									break;
-									case 1:
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-
-									for (int i = 0; i < 2; i++){for (int j = 0; j < 2; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f;
-
-									Generateline(&geometry, &shader, vertices, colours);
-									RenderControlLines(&geometry, &shader);
-									break;
-									case 2:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 0.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 3);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-
-									for (int i = 0; i < 3; i++){for (int j = 0; j < 3; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f;
-
-									GenerateQuadratic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-
-									if(g)
-										if(vertices[0][0] < -3.0)
-											end = true;
-									break;
-									case 3:
-									glUseProgram(shader.program);
-									glUniform2f(loc1, 1.0, 0.0);
-									glPatchParameteri(GL_PATCH_VERTICES, 4);
-
-									vertices[0][0] = (float)((glyph.contours[i][j].x[0]+advance)/scale)+move;  vertices[0][1] = (float)(glyph.contours[i][j].y[0]+(translation*scale))/scale;
-									vertices[1][0] = (float)((glyph.contours[i][j].x[1]+advance)/scale)+move;  vertices[1][1] = (float)(glyph.contours[i][j].y[1]+(translation*scale))/scale;
-									vertices[2][0] = (float)((glyph.contours[i][j].x[2]+advance)/scale)+move;  vertices[2][1] = (float)(glyph.contours[i][j].y[2]+(translation*scale))/scale;
-									vertices[3][0] = (float)((glyph.contours[i][j].x[3]+advance)/scale)+move;  vertices[3][1] = (float)(glyph.contours[i][j].y[3]+(translation*scale))/scale;
-
-									for (int i = 0; i < 4; i++){for (int j = 0; j < 4; j++){colours[i][j] = 0.0f;}}
-									colours[0][0] = 1.0f; colours[1][0] = 1.0f; colours[2][0] = 1.0f; colours[3][0] = 1.0f;
-
-									GenerateCubic(&geometry, &shader, vertices, colours);
-									RenderBezier(&geometry, &shader);
-									break;
-								}
-							}
-						}
-						advance = advance + glyph.advance;
-					}
+		}
+		MyLevelBake *current = &levels[level-1];
+
+		// only the scrollers and swept axes change on their own; static levels
+		// are drawn once and then left on screen until something changes
+		bool animated = (level >= 6 || (level == 5 && sweepAxes)) && current->baked;
+		if (animated || redraw || !renderOnDemand)
+		{
+			redraw = false;
+			glyphs.frame++;
+			BeginStateFrame();
+			BeginFrameTimer(&pipeline);
+			double frameStart = glfwGetTime();
+
+			// advance the scrollers by whole animation steps, starting over
+			// once the whole run has scrolled off the left edge
+			int steps = AdvanceFrameClock(&clock, glfwGetTime(), animated || !renderOnDemand);
+			if (animated && level >= 6) {
+				MyTextRun run = ScrollerRun(level, scale, 0.0f);
+				float end = TextAdvance(&glyphs, run.font, run.text) * run.scale;
+				for (int i = 0; i < steps; i++) {
+					if (run.x + move + end < -3.0)
+						move = 1.0;
+					else
+						move = move - rate;
 				}
-			break;
+			}
+			// the axes swing between their extremes, at different rates so that
+			// every combination comes round; only the shader sees the change
+			if (sweepAxes)
+				axisPhase += steps * 0.02f;
+			else
+				axisPhase = 0.0f;
+			shader.variation[0] = sin(axisPhase);
+			shader.variation[1] = sin(0.7f * axisPhase);
+
+			if (reportPacing) {
+				ReportFramePacing(&clock, &pipeline);
+				reportPacing = false;
+			}
+			if (reportGlyphs) {
+				ReportGlyphCache(&glyphs);
+				reportGlyphs = false;
+			}
 
-		}
+			// keep the viewport matched to the framebuffer
+			int fbWidth, fbHeight;
+			glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+			if (fbWidth != width || fbHeight != height) {
+				width = fbWidth;
+				height = fbHeight;
+				glViewport(0, 0, width, height);
+			}
 
+			ClearScene(&geometry, &shader);
 
+			shader.offset[0] = (level >= 6) ? move : 0.0f;
+
+			if (captureCurves && level <= 5 && !animated && current->baked)
+			{
+				// static levels: replay the recorded curves, or record them if
+				// the scene or viewport changed since the last capture
+				if (CurveCaptureCurrent(&capture, level, width, height)) {
+					ReplayCurves(&capture, &shader);
+					RenderLevel(current, PASS_OVERLAY, &glyphs, &shader);
+				}
+				else {
+					BeginCurveCapture(&capture, &shader, level, width, height);
+					RenderLevel(current, PASS_ALL, &glyphs, &shader);
+					EndCurveCapture(&capture);
+				}
+			}
+			else
+				RenderLevel(current, PASS_ALL, &glyphs, &shader);
 
-		glfwSwapBuffers(window);
+			clock.cpuTotal += glfwGetTime() - frameStart;
+			clock.cpuFrames++;
+			glfwSwapBuffers(window);
+		}
+		EndPipelinedFrame(&pipeline);
 
-		glfwPollEvents();
+		// sleep until the next event unless there is animation to keep up
+		if (animated || !renderOnDemand)
+			glfwPollEvents();
+		else
+			glfwWaitEvents();
 	}
 
 	// clean up allocated resources before exit
 	DestroyGeometry(&geometry);
+	loader.Stop();
+	for (int l = 0; l < 8; l++)
+		DestroyLevelBake(&levels[l]);
+	DestroyGlyphCache(&glyphs);
+	DestroyCurveCapture(&capture);
+	DestroyFramePipeline(&pipeline);
 	DestroyShaders(&shader);
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -1467,6 +2544,53 @@ bool CheckGLErrors()
 	return error;
 }
 
+// --------------------------------------------------------------------------
+// OpenGL debug output
+//
+// Rather than polling glGetError after every call, debug builds have the
+// driver report errors and warnings through a KHR_debug message callback as
+// they occur. Release builds (NDEBUG) compile this out, leaving CheckGLErrors
+// for the explicit checkpoints during initialization.
+
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT                 0x92E0
+#define GL_DEBUG_TYPE_ERROR             0x824C
+#define GL_DEBUG_SEVERITY_NOTIFICATION  0x826B
+#endif
+
+#ifndef NDEBUG
+void APIENTRY DebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar *message, const void *userParam)
+{
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) return;
+
+	cout << "OpenGL " << (type == GL_DEBUG_TYPE_ERROR ? "ERROR" : "WARNING")
+		<< " [" << id << "]:  " << message << endl;
+}
+#endif
+
+void InitializeDebugOutput()
+{
+#ifndef NDEBUG
+	// the entry point is looked up at run time, as it is newer than the
+	// OpenGL 4.1 core profile we ask for
+	typedef void (APIENTRY *DebugMessageCallbackProc)(GLDEBUGPROC callback, const void *userParam);
+	DebugMessageCallbackProc debugMessageCallback = 0;
+	if (glfwExtensionSupported("GL_KHR_debug"))
+		debugMessageCallback = (DebugMessageCallbackProc)glfwGetProcAddress("glDebugMessageCallback");
+
+	if (!debugMessageCallback) {
+		cout << "KHR_debug unavailable, OpenGL errors are only checked during setup" << endl;
+		return;
+	}
+
+	// asynchronous output: messages may arrive after the offending call, but
+	// the driver does not have to synchronize on every call to produce them
+	debugMessageCallback(DebugMessageCallback, 0);
+	glEnable(GL_DEBUG_OUTPUT);
+#endif
+}
+
 // --------------------------------------------------------------------------
 // OpenGL shader support functions
 
@@ -11,14 +11,40 @@
 layout(location = 0) in vec2 VertexPosition;
 layout(location = 1) in vec3 VertexColour;
 
+// placement of an instanced glyph: xy offset and w scale. Non-instanced draws
+// leave this attribute disabled, so it reads the default (0,0,0,1), which is
+// the identity transform.
+layout(location = 2) in vec4 InstanceTransform;
+
+// offsets of a variable font glyph's control points at the maximum and minimum
+// of its first and second variation axes, in the same units as its position.
+// These attributes are disabled for everything else, so they read zero.
+layout(location = 3) in vec2 VertexDeltaMax0;
+layout(location = 4) in vec2 VertexDeltaMin0;
+layout(location = 5) in vec2 VertexDeltaMax1;
+layout(location = 6) in vec2 VertexDeltaMin1;
+
+// translation applied to everything drawn, used to scroll prebaked text
+uniform vec2 Offset;
+
+// setting of each variation axis, from -1 (its minimum) through 0 (the
+// default instance) to 1 (its maximum)
+uniform vec2 Variation;
+
 // output to be interpolated between vertices and passed to the fragment stage
 out vec3 tcColour;
 out vec3 Colour;
 
 void main()
 {
-    // assign vertex position without modification
-    gl_Position = vec4(VertexPosition, 0.0, 1.0);
+    // move the control point towards the instance at the current axis setting,
+    // interpolating each axis linearly between the default and its extreme
+    vec2 position = VertexPosition
+        + max(Variation.x, 0.0) * VertexDeltaMax0 + max(-Variation.x, 0.0) * VertexDeltaMin0
+        + max(Variation.y, 0.0) * VertexDeltaMax1 + max(-Variation.y, 0.0) * VertexDeltaMin1;
+
+    // place the vertex, which is unmodified for non-instanced draws
+    gl_Position = vec4(position * InstanceTransform.w + InstanceTransform.xy + Offset, 0.0, 1.0);
 
     // assign output colour to be interpolated
     tcColour = VertexColour;